@@ -0,0 +1,616 @@
+/*
+    Copyright (c) 2023 BB-301 <fw3dg3@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the “Software”), to deal in the Software without restriction,
+    including without limitation the rights to use, copy, modify, merge,
+    publish, distribute, sublicense, and/or sell copies of the Software,
+    and to permit persons to whom the Software is furnished to do so,
+    subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "fancy_memory.h"
+
+// The largest number of live pointers to benchmark (in powers of ten, starting at
+// 10^3). Defaults to 10^6, such that the suite runs quickly, and can be raised to 10^7
+// using `make bench BENCH_MAX_LIVE=10000000`.
+#ifndef BENCH_MAX_LIVE
+#define BENCH_MAX_LIVE (1000000)
+#endif
+// Small cases are repeated until at least this many operations have been timed.
+#define BENCH_MIN_OPERATIONS (2000000)
+#define BENCH_SMALL_SIZE (32)
+#define BENCH_THREAD_OPERATIONS (500000)
+#define BENCH_THREAD_LIVE_POINTERS (1024)
+#define BENCH_MAX_THREADS (8)
+// The largest size reached by the buffer growth benchmark (which starts at 1 MiB).
+#ifndef BENCH_MAX_GROWTH
+#define BENCH_MAX_GROWTH (1024 * 1024 * 1024)
+#endif
+#define BENCH_GROWTH_ROUNDS (3)
+#define BENCH_BURST_SIZE (4096)
+#define BENCH_BURST_COUNT (500)
+#define BENCH_REMOTE_CONSUMERS (3)
+// The name of the build configuration (e.g., "lto" or "pgo") that is written along with
+// each result, such that the results of different builds can be compared.
+#ifndef BENCH_BUILD
+#define BENCH_BUILD "default"
+#endif
+
+typedef struct
+{
+    char const *name;
+    fancy_memory_backend_t backend;
+    // `true` for plain malloc/realloc/free (i.e., without any tracking).
+    bool untracked;
+} bench_allocator_t;
+
+typedef struct
+{
+    char const *name;
+    // Runs the pattern once over `n` live pointers and returns the number of operations.
+    size_t (*run)(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state);
+} bench_pattern_t;
+
+typedef struct
+{
+    fancy_memory_t *m;
+    pthread_mutex_t *lock;
+    uint64_t state;
+} bench_thread_t;
+
+typedef struct
+{
+    fancy_memory_t *m;
+    pthread_mutex_t *lock;
+    void **pointers;
+    size_t n;
+    double seconds;
+} bench_consumer_t;
+
+static bench_allocator_t const allocators[] = {
+    {"malloc", FANCY_MEMORY_BACKEND_SYSTEM, true},
+    {"system", FANCY_MEMORY_BACKEND_SYSTEM, false},
+    {"pool", FANCY_MEMORY_BACKEND_POOL, false},
+    {"header", FANCY_MEMORY_BACKEND_HEADER, false},
+};
+
+static FILE *results;
+
+static uint64_t next_random(uint64_t *state);
+static double now_in_seconds(void);
+static long peak_rss_in_kilobytes(void);
+static void *bench_malloc(bench_allocator_t const *allocator, fancy_memory_t *m, size_t size);
+static void *bench_realloc(bench_allocator_t const *allocator, fancy_memory_t *m, void *pointer, size_t size);
+static void bench_free(bench_allocator_t const *allocator, fancy_memory_t *m, void *pointer);
+static size_t pattern_lifo(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state);
+static size_t pattern_fifo(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state);
+static size_t pattern_random(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state);
+static size_t pattern_realloc_growth(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state);
+static size_t pattern_mixed_sizes(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state);
+static void report(char const *pattern, char const *allocator, size_t live, size_t threads, size_t operations, double seconds);
+static void *thread_churn(void *argument);
+static void bench_threads(void);
+static void bench_bursts(void);
+static void bench_growth(void);
+static void *consumer_free(void *argument);
+static void bench_remote(void);
+
+static bench_pattern_t const patterns[] = {
+    {"lifo", pattern_lifo},
+    {"fifo", pattern_fifo},
+    {"random", pattern_random},
+    {"realloc_growth", pattern_realloc_growth},
+    {"mixed_sizes", pattern_mixed_sizes},
+};
+
+int main(int argc, char **argv)
+{
+    char const *path = argc > 1 ? argv[1] : "build/bench_results.jsonl";
+    results = fopen(path, "w");
+    if (results == NULL)
+    {
+        fprintf(stderr, "Unable to open '%s' for writing.\n", path);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stdout, "%-16s %-12s %10s %8s %12s %14s %12s\n",
+            "pattern", "allocator", "live", "threads", "ns/op", "ops/s", "peak_rss_kb");
+    void **pointers = malloc(sizeof(void *) * BENCH_MAX_LIVE);
+    if (pointers == NULL)
+    {
+        fprintf(stderr, "Call to 'malloc' returned the NULL pointer.\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++)
+    {
+        for (size_t n = 1000; n <= BENCH_MAX_LIVE; n *= 10)
+        {
+            for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++)
+            {
+                uint64_t state = UINT64_C(0x2545F4914F6CDD1D);
+                fancy_memory_t *m = allocators[a].untracked ? NULL : fancy_memory_create_with_backend(allocators[a].backend);
+                size_t operations = 0;
+                double start = now_in_seconds();
+                do
+                {
+                    operations += patterns[p].run(&allocators[a], m, pointers, n, &state);
+                } while (operations < BENCH_MIN_OPERATIONS);
+                double seconds = now_in_seconds() - start;
+                if (m != NULL)
+                {
+                    fancy_memory_destroy(m);
+                }
+                report(patterns[p].name, allocators[a].name, n, 1, operations, seconds);
+            }
+        }
+    }
+    free(pointers);
+
+    bench_threads();
+    bench_bursts();
+    bench_growth();
+    bench_remote();
+    fclose(results);
+    fprintf(stdout, "\nResults written to '%s'.\n", path);
+    return EXIT_SUCCESS;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(2685821657736338717);
+}
+
+static double now_in_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static long peak_rss_in_kilobytes(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void *bench_malloc(bench_allocator_t const *allocator, fancy_memory_t *m, size_t size)
+{
+    return allocator->untracked ? malloc(size) : fancy_memory_malloc(m, size);
+}
+
+static void *bench_realloc(bench_allocator_t const *allocator, fancy_memory_t *m, void *pointer, size_t size)
+{
+    return allocator->untracked ? realloc(pointer, size) : fancy_memory_realloc(m, pointer, size);
+}
+
+static void bench_free(bench_allocator_t const *allocator, fancy_memory_t *m, void *pointer)
+{
+    if (allocator->untracked)
+    {
+        free(pointer);
+    }
+    else
+    {
+        fancy_memory_free(m, pointer);
+    }
+}
+
+static size_t pattern_lifo(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state)
+{
+    (void)state;
+    for (size_t i = 0; i < n; i++)
+    {
+        pointers[i] = bench_malloc(allocator, m, BENCH_SMALL_SIZE);
+    }
+    for (size_t i = n; i > 0; i--)
+    {
+        bench_free(allocator, m, pointers[i - 1]);
+    }
+    return 2 * n;
+}
+
+static size_t pattern_fifo(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state)
+{
+    (void)state;
+    for (size_t i = 0; i < n; i++)
+    {
+        pointers[i] = bench_malloc(allocator, m, BENCH_SMALL_SIZE);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        bench_free(allocator, m, pointers[i]);
+    }
+    return 2 * n;
+}
+
+static size_t pattern_random(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        pointers[i] = bench_malloc(allocator, m, BENCH_SMALL_SIZE);
+    }
+    // Fisher-Yates shuffle, so that the pointers are freed in a random order.
+    for (size_t i = n - 1; i > 0; i--)
+    {
+        size_t j = (size_t)(next_random(state) % (i + 1));
+        void *swap = pointers[i];
+        pointers[i] = pointers[j];
+        pointers[j] = swap;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        bench_free(allocator, m, pointers[i]);
+    }
+    return 2 * n;
+}
+
+static size_t pattern_realloc_growth(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state)
+{
+    // Every eighth pointer is a buffer that grows by doubling, from 16 bytes to 4 KiB.
+    (void)state;
+    size_t count = n / 8;
+    size_t operations = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        pointers[i] = bench_malloc(allocator, m, 16);
+    }
+    for (size_t size = 32; size <= 4096; size *= 2)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            pointers[i] = bench_realloc(allocator, m, pointers[i], size);
+        }
+        operations += count;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        bench_free(allocator, m, pointers[i]);
+    }
+    return operations + 2 * count;
+}
+
+static size_t pattern_mixed_sizes(bench_allocator_t const *allocator, fancy_memory_t *m, void **pointers, size_t n, uint64_t *state)
+{
+    // Mostly small sizes (below 256 bytes), with one request out of sixteen of up to
+    // 4 KiB, and steady-state churn (i.e., a random free followed by an allocation).
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t r = next_random(state);
+        pointers[i] = bench_malloc(allocator, m, (r % 16 == 0) ? (size_t)(r >> 52) : (size_t)(r >> 56));
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t r = next_random(state);
+        size_t j = (size_t)((r >> 8) % n);
+        bench_free(allocator, m, pointers[j]);
+        pointers[j] = bench_malloc(allocator, m, (r % 16 == 0) ? (size_t)(r >> 52) : (size_t)(r >> 56));
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        bench_free(allocator, m, pointers[i]);
+    }
+    return 4 * n;
+}
+
+static void report(char const *pattern, char const *allocator, size_t live, size_t threads, size_t operations, double seconds)
+{
+    double ns_per_operation = seconds * 1e9 / (double)operations;
+    double operations_per_second = (double)operations / seconds;
+    long peak_rss = peak_rss_in_kilobytes();
+    fprintf(stdout, "%-16s %-12s %10zu %8zu %12.2f %14.0f %12ld\n",
+            pattern, allocator, live, threads, ns_per_operation, operations_per_second, peak_rss);
+    fprintf(results,
+            "{\"build\":\"%s\",\"pattern\":\"%s\",\"allocator\":\"%s\",\"live\":%zu,\"threads\":%zu,\"operations\":%zu,"
+            "\"seconds\":%.9f,\"ns_per_op\":%.3f,\"ops_per_sec\":%.0f,\"peak_rss_kb\":%ld}\n",
+            BENCH_BUILD, pattern, allocator, live, threads, operations, seconds, ns_per_operation, operations_per_second, peak_rss);
+    fflush(stdout);
+}
+
+static void *thread_churn(void *argument)
+{
+    bench_thread_t *thread = argument;
+    void *pointers[BENCH_THREAD_LIVE_POINTERS] = {0};
+    for (size_t i = 0; i < BENCH_THREAD_OPERATIONS; i++)
+    {
+        size_t j = (size_t)(next_random(&thread->state) % BENCH_THREAD_LIVE_POINTERS);
+        if (thread->m == NULL)
+        {
+            free(pointers[j]);
+            pointers[j] = malloc(BENCH_SMALL_SIZE);
+            continue;
+        }
+        if (thread->lock != NULL)
+        {
+            pthread_mutex_lock(thread->lock);
+        }
+        if (pointers[j] != NULL)
+        {
+            fancy_memory_free(thread->m, pointers[j]);
+        }
+        pointers[j] = fancy_memory_malloc(thread->m, BENCH_SMALL_SIZE);
+        if (thread->lock != NULL)
+        {
+            pthread_mutex_unlock(thread->lock);
+        }
+    }
+    for (size_t j = 0; j < BENCH_THREAD_LIVE_POINTERS; j++)
+    {
+        if (thread->m == NULL)
+        {
+            free(pointers[j]);
+        }
+        else if (pointers[j] != NULL)
+        {
+            if (thread->lock != NULL)
+            {
+                pthread_mutex_lock(thread->lock);
+            }
+            fancy_memory_free(thread->m, pointers[j]);
+            if (thread->lock != NULL)
+            {
+                pthread_mutex_unlock(thread->lock);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void bench_threads(void)
+{
+    // Compares plain malloc/free, a regular tracker behind a global mutex, and a
+    // concurrent (sharded) tracker, with an increasing number of threads.
+    char const *names[] = {"malloc", "global_mutex", "concurrent"};
+    for (size_t variant = 0; variant < 3; variant++)
+    {
+        for (size_t thread_count = 1; thread_count <= BENCH_MAX_THREADS; thread_count *= 2)
+        {
+            pthread_mutex_t lock;
+            pthread_mutex_init(&lock, NULL);
+            fancy_memory_t *m = NULL;
+            if (variant == 1)
+            {
+                m = fancy_memory_create();
+            }
+            else if (variant == 2)
+            {
+                m = fancy_memory_create_concurrent(0);
+            }
+            pthread_t threads[BENCH_MAX_THREADS];
+            bench_thread_t arguments[BENCH_MAX_THREADS];
+            double start = now_in_seconds();
+            for (size_t i = 0; i < thread_count; i++)
+            {
+                arguments[i] = (bench_thread_t){m, variant == 1 ? &lock : NULL, UINT64_C(0x9E3779B97F4A7C15) * (i + 1)};
+                pthread_create(&threads[i], NULL, thread_churn, &arguments[i]);
+            }
+            for (size_t i = 0; i < thread_count; i++)
+            {
+                pthread_join(threads[i], NULL);
+            }
+            double seconds = now_in_seconds() - start;
+            if (m != NULL)
+            {
+                fancy_memory_destroy(m);
+            }
+            pthread_mutex_destroy(&lock);
+            report("threads", names[variant], BENCH_THREAD_LIVE_POINTERS * thread_count, thread_count,
+                   2 * BENCH_THREAD_OPERATIONS * thread_count, seconds);
+        }
+    }
+}
+
+static void bench_bursts(void)
+{
+    // Compares allocating (and then freeing) bursts of nodes one at a time against
+    // using the batch methods, for each backend that handles batches specially.
+    fancy_memory_backend_t backends[] = {FANCY_MEMORY_BACKEND_SYSTEM, FANCY_MEMORY_BACKEND_POOL, FANCY_MEMORY_BACKEND_ARENA};
+    char const *names[] = {"system", "pool", "arena"};
+    size_t sizes[BENCH_BURST_SIZE];
+    void *pointers[BENCH_BURST_SIZE];
+    uint64_t state = UINT64_C(0x2545F4914F6CDD1D);
+    for (size_t i = 0; i < BENCH_BURST_SIZE; i++)
+    {
+        sizes[i] = 16 + (size_t)(next_random(&state) % 48);
+    }
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        for (size_t many = 0; many < 2; many++)
+        {
+            fancy_memory_t *m = fancy_memory_create_with_backend(backends[b]);
+            double start = now_in_seconds();
+            for (size_t burst = 0; burst < BENCH_BURST_COUNT; burst++)
+            {
+                if (many)
+                {
+                    fancy_memory_malloc_many(m, sizes, BENCH_BURST_SIZE, pointers);
+                    fancy_memory_free_many(m, pointers, BENCH_BURST_SIZE);
+                }
+                else
+                {
+                    for (size_t i = 0; i < BENCH_BURST_SIZE; i++)
+                    {
+                        pointers[i] = fancy_memory_malloc(m, sizes[i]);
+                    }
+                    for (size_t i = 0; i < BENCH_BURST_SIZE; i++)
+                    {
+                        fancy_memory_free(m, pointers[i]);
+                    }
+                }
+                // A fresh tracker for each burst, as with a parser's per-document tracker.
+                fancy_memory_destroy(m);
+                m = fancy_memory_create_with_backend(backends[b]);
+            }
+            double seconds = now_in_seconds() - start;
+            fancy_memory_destroy(m);
+            char name[32];
+            snprintf(name, sizeof(name), "%s_%s", names[b], many ? "many" : "loop");
+            report("bursts", name, BENCH_BURST_SIZE, 1, 2 * BENCH_BURST_SIZE * BENCH_BURST_COUNT, seconds);
+        }
+    }
+}
+
+static void bench_growth(void)
+{
+    // Grows a buffer from 1 MiB to `BENCH_MAX_GROWTH` by doubling, using plain
+    // `realloc`, a tracker (i.e., the heap path), and a tracker that maps large blocks
+    // (i.e., the `mremap` path). Only the reallocations are timed: every page is
+    // written between them (so that there is content to preserve), which is excluded.
+    char const *names[] = {"malloc", "system", "mapped"};
+    for (size_t variant = 0; variant < 3; variant++)
+    {
+        size_t operations = 0;
+        double seconds = 0;
+        for (size_t round = 0; round < BENCH_GROWTH_ROUNDS; round++)
+        {
+            fancy_memory_t *m = NULL;
+            if (variant > 0)
+            {
+                m = fancy_memory_create();
+                fancy_memory_set_large_threshold(m, variant == 2 ? 1024 * 1024 : 0);
+            }
+            size_t size = 1024 * 1024;
+            char *buffer = variant == 0 ? malloc(size) : fancy_memory_malloc(m, size);
+            memset(buffer, 1, size);
+            while (size < (size_t)BENCH_MAX_GROWTH)
+            {
+                double start = now_in_seconds();
+                buffer = variant == 0 ? realloc(buffer, 2 * size) : fancy_memory_realloc(m, buffer, 2 * size);
+                seconds += now_in_seconds() - start;
+                operations += 1;
+                memset(buffer + size, 1, size);
+                size *= 2;
+            }
+            if (variant == 0)
+            {
+                free(buffer);
+            }
+            else
+            {
+                fancy_memory_free(m, buffer);
+                fancy_memory_destroy(m);
+            }
+        }
+        report("growth_doubling", names[variant], 1, 1, operations, seconds);
+    }
+}
+
+static void *consumer_free(void *argument)
+{
+    bench_consumer_t *consumer = argument;
+    double start = now_in_seconds();
+    for (size_t i = 0; i < consumer->n; i++)
+    {
+        if (consumer->lock == NULL)
+        {
+            fancy_memory_free_remote(consumer->m, consumer->pointers[i]);
+            continue;
+        }
+        pthread_mutex_lock(consumer->lock);
+        fancy_memory_free(consumer->m, consumer->pointers[i]);
+        pthread_mutex_unlock(consumer->lock);
+    }
+    consumer->seconds = now_in_seconds() - start;
+    return NULL;
+}
+
+static void bench_remote(void)
+{
+    // Consumer threads free messages allocated by the producer (i.e., the main thread),
+    // which keeps allocating and freeing its own blocks meanwhile, either by taking the
+    // tracker's (global) mutex, or by using remote frees (which the producer drains).
+    // The consumers' frees are timed on their own, as well as along with the producer's
+    // work (including the draining).
+    char const *names[] = {"global_mutex", "remote"};
+    for (size_t variant = 0; variant < 2; variant++)
+    {
+        pthread_mutex_t lock;
+        pthread_mutex_init(&lock, NULL);
+        fancy_memory_t *m = fancy_memory_create();
+        bench_consumer_t consumers[BENCH_REMOTE_CONSUMERS];
+        pthread_t threads[BENCH_REMOTE_CONSUMERS];
+        for (size_t i = 0; i < BENCH_REMOTE_CONSUMERS; i++)
+        {
+            consumers[i] = (bench_consumer_t){m, variant == 0 ? &lock : NULL, malloc(sizeof(void *) * BENCH_THREAD_OPERATIONS), BENCH_THREAD_OPERATIONS, 0};
+            if (consumers[i].pointers == NULL)
+            {
+                fprintf(stderr, "Call to 'malloc' returned the NULL pointer.\n");
+                exit(EXIT_FAILURE);
+            }
+            for (size_t j = 0; j < BENCH_THREAD_OPERATIONS; j++)
+            {
+                consumers[i].pointers[j] = fancy_memory_malloc(m, BENCH_SMALL_SIZE);
+            }
+        }
+        void *pointers[BENCH_THREAD_LIVE_POINTERS] = {0};
+        uint64_t state = UINT64_C(0x2545F4914F6CDD1D);
+        double start = now_in_seconds();
+        for (size_t i = 0; i < BENCH_REMOTE_CONSUMERS; i++)
+        {
+            pthread_create(&threads[i], NULL, consumer_free, &consumers[i]);
+        }
+        for (size_t i = 0; i < BENCH_THREAD_OPERATIONS; i++)
+        {
+            size_t j = (size_t)(next_random(&state) % BENCH_THREAD_LIVE_POINTERS);
+            if (variant == 0)
+            {
+                pthread_mutex_lock(&lock);
+            }
+            if (pointers[j] != NULL)
+            {
+                fancy_memory_free(m, pointers[j]);
+            }
+            pointers[j] = fancy_memory_malloc(m, BENCH_SMALL_SIZE);
+            if (variant == 0)
+            {
+                pthread_mutex_unlock(&lock);
+            }
+        }
+        double consumer_seconds = 0;
+        for (size_t i = 0; i < BENCH_REMOTE_CONSUMERS; i++)
+        {
+            pthread_join(threads[i], NULL);
+            consumer_seconds += consumers[i].seconds;
+        }
+        fancy_memory_collect(m);
+        double seconds = now_in_seconds() - start;
+        for (size_t i = 0; i < BENCH_REMOTE_CONSUMERS; i++)
+        {
+            free(consumers[i].pointers);
+        }
+        fancy_memory_reset(m);
+        fancy_memory_destroy(m);
+        pthread_mutex_destroy(&lock);
+        report("remote_consumers", names[variant], BENCH_THREAD_LIVE_POINTERS, BENCH_REMOTE_CONSUMERS,
+               BENCH_REMOTE_CONSUMERS * BENCH_THREAD_OPERATIONS, consumer_seconds / BENCH_REMOTE_CONSUMERS);
+        report("remote_frees", names[variant], BENCH_THREAD_LIVE_POINTERS, 1 + BENCH_REMOTE_CONSUMERS,
+               (2 + BENCH_REMOTE_CONSUMERS) * BENCH_THREAD_OPERATIONS, seconds);
+    }
+}
@@ -29,6 +29,7 @@
 #define __FANCY_MEMORY_H__
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -48,6 +49,199 @@
  */
 typedef struct fancy_memory_s fancy_memory_t;
 
+/**
+ * @brief An enumeration of the allocation backends that can be selected when creating
+ * a \ref fancy_memory_t object using \ref fancy_memory_create_with_backend.
+ */
+typedef enum
+{
+    /** @brief Every allocation is served by the system allocator (i.e., \ref malloc()). */
+    FANCY_MEMORY_BACKEND_SYSTEM = 0,
+    /**
+     * @brief Allocations of up to 256 bytes are served from fixed size classes carved
+     * out of large slabs (with per-class free lists), while larger allocations are
+     * served by the system allocator.
+     *
+     * @note The tracked sizes (e.g., as returned by \ref fancy_memory_get_total) are
+     * always the exact requested sizes, not the size class sizes.
+     * @note Pooled memory is handed back to the system, in bulk, only when the
+     * \ref fancy_memory_t object is destroyed.
+     */
+    FANCY_MEMORY_BACKEND_POOL = 1,
+    /**
+     * @brief Allocations are bump-allocated out of large chunks, and released all at
+     * once using \ref fancy_memory_reset (see \ref fancy_memory_create_arena).
+     */
+    FANCY_MEMORY_BACKEND_ARENA = 2,
+    /**
+     * @brief Every allocation is served by the system allocator, with a small header
+     * placed in front of the returned memory. That header holds the block's size and a
+     * tag identifying the owning \ref fancy_memory_t object, such that
+     * \ref fancy_memory_free and \ref fancy_memory_realloc never need to search for
+     * the block: they only check the tag, which takes constant time.
+     *
+     * @note The tag check reads the memory right in front of the pointer being freed,
+     * so passing a pointer that was not allocated by any \ref fancy_memory_t object
+     * should be expected to terminate the process, but is not guaranteed to.
+     */
+    FANCY_MEMORY_BACKEND_HEADER = 3,
+} fancy_memory_backend_t;
+
+/**
+ * @brief A snapshot of the statistics maintained by a \ref fancy_memory_t object,
+ * as returned by the \ref fancy_memory_get_stats method.
+ *
+ * @note All of these values are maintained incrementally by the allocation methods,
+ * so retrieving them takes constant time, regardless of the number of tracked
+ * allocations.
+ */
+typedef struct
+{
+    /**
+     * @brief The total number of bytes currently being tracked, excluding those of the
+     * retired blocks (see \ref fancy_memory_retire) that are still pending.
+     */
+    size_t live_bytes;
+    /** @brief The number of allocations currently being tracked (excluding retired ones). */
+    size_t live_count;
+    /**
+     * @brief The highest value ever reached by \ref fancy_memory_stats_t::live_bytes (an
+     * upper bound of it for concurrent objects, see \ref fancy_memory_create_concurrent).
+     */
+    size_t peak_bytes;
+    /** @brief The highest value ever reached by \ref fancy_memory_stats_t::live_count (likewise). */
+    size_t peak_count;
+    /** @brief The cumulative number of allocations (i.e., \ref fancy_memory_malloc calls). */
+    uint64_t allocation_count;
+    /** @brief The cumulative number of frees (i.e., \ref fancy_memory_free calls). */
+    uint64_t free_count;
+    /** @brief The cumulative number of reallocations (i.e., \ref fancy_memory_realloc calls). */
+    uint64_t reallocation_count;
+    /**
+     * @brief The total number of bytes of the retired blocks (see \ref fancy_memory_retire)
+     * that have not been freed yet (i.e., that readers may still be using).
+     */
+    size_t retired_bytes;
+    /** @brief The number of retired blocks that have not been freed yet. */
+    size_t retired_count;
+} fancy_memory_stats_t;
+
+/**
+ * @brief The statistics maintained for a single allocation site (i.e., a source
+ * location from which memory is allocated using \ref FANCY_MEMORY_MALLOC or
+ * \ref FANCY_MEMORY_REALLOC), as returned by \ref fancy_memory_get_top_sites .
+ */
+typedef struct
+{
+    /** @brief The name of the source file of the allocation site (i.e., `__FILE__`). */
+    char const *file;
+    /** @brief The line of the allocation site (i.e., `__LINE__`). */
+    int line;
+    /** @brief The name of the function containing the allocation site (i.e., `__func__`). */
+    char const *function;
+    /** @brief The total number of bytes currently being tracked for this site. */
+    size_t live_bytes;
+    /** @brief The number of allocations currently being tracked for this site. */
+    size_t live_count;
+    /** @brief The cumulative number of blocks allocated (or moved, by a reallocation) from this site. */
+    uint64_t allocation_count;
+    /** @brief The cumulative number of bytes allocated (or grown, by a reallocation) from this site. */
+    uint64_t allocated_bytes;
+} fancy_memory_site_stats_t;
+
+/**
+ * @brief The number of buckets of each histogram in \ref fancy_memory_histograms_t .
+ */
+#define FANCY_MEMORY_HISTOGRAM_BUCKETS (65)
+
+/**
+ * @brief The log2-bucketed histograms maintained by a \ref fancy_memory_t object, as
+ * returned by the \ref fancy_memory_get_histograms method.
+ *
+ * @note Bucket `0` counts the value `0`, while bucket `k` (for `k > 0`) counts the
+ * values in the range `[2^(k - 1), 2^k - 1]`.
+ */
+typedef struct
+{
+    /**
+     * @brief The requested sizes, in bytes, of every allocation and reallocation (i.e.,
+     * \ref fancy_memory_malloc and \ref fancy_memory_realloc calls).
+     */
+    uint64_t sizes[FANCY_MEMORY_HISTOGRAM_BUCKETS];
+    /**
+     * @brief The lifetimes of the freed blocks (i.e., from their allocation to their
+     * \ref fancy_memory_free call), measured in operations (i.e., allocations, frees and
+     * reallocations) performed on the tracker in between.
+     *
+     * @note Reallocations do not end a block's lifetime, and blocks released by
+     * \ref fancy_memory_reset are not counted.
+     * @note For concurrent objects (see \ref fancy_memory_create_concurrent), lifetimes
+     * are measured in operations performed on the block's shard.
+     */
+    uint64_t lifetimes[FANCY_MEMORY_HISTOGRAM_BUCKETS];
+} fancy_memory_histograms_t;
+
+/**
+ * @brief A tracked block, as passed to a \ref fancy_memory_visitor_t function or
+ * returned by \ref fancy_memory_iterator_next .
+ */
+typedef struct
+{
+    /** @brief The address of the block (i.e., as returned by \ref fancy_memory_malloc). */
+    void *address;
+    /** @brief The (requested) size of the block, in bytes. */
+    size_t size;
+    /**
+     * @brief The statistics of the block's allocation site, or the \ref NULL pointer if
+     * the block is not attributed to a site (see \ref FANCY_MEMORY_MALLOC).
+     */
+    fancy_memory_site_stats_t const *site;
+} fancy_memory_block_t;
+
+/**
+ * @brief The type of the functions that can be passed to \ref fancy_memory_foreach ,
+ * which are called once for each tracked block.
+ *
+ * @param block A pointer to the visited block, which is only valid during the call.
+ * @param context The context pointer passed to \ref fancy_memory_foreach .
+ * @return \ref bool `true` to keep visiting blocks, or `false` to stop.
+ * @warning The visitor must not call any method on the visited \ref fancy_memory_t object.
+ */
+typedef bool (*fancy_memory_visitor_t)(fancy_memory_block_t const *block, void *context);
+
+/**
+ * @brief A cursor over the blocks tracked by a \ref fancy_memory_t object, which is
+ * initialized using \ref fancy_memory_iterator_init and advanced using
+ * \ref fancy_memory_iterator_next .
+ *
+ * @note The members of this structure are private: it is only declared here such that
+ * it can be placed on the stack (i.e., iterating never allocates memory).
+ */
+typedef struct
+{
+    /** @private */
+    fancy_memory_t const *tracker;
+    /** @private */
+    size_t min_size;
+    /** @private */
+    size_t max_size;
+    /** @private */
+    size_t shard;
+    /** @private */
+    size_t position;
+    /** @private */
+    void const *header;
+    /** @private */
+    size_t handle;
+} fancy_memory_iterator_t;
+
+/**
+ * @brief An opaque reference to a (movable) block allocated using
+ * \ref fancy_memory_handle_alloc , whose address can be obtained using
+ * \ref fancy_memory_pin . Valid handles are never `0`.
+ */
+typedef uint64_t fancy_memory_handle_t;
+
 /**
  * @brief A method that can be used to retrieve the library's current version. It works
  * by populating the arguments \p major , \p minor , and \p revision with
@@ -67,6 +261,89 @@ void fancy_memory_get_library_version(uint16_t *major, uint16_t *minor, uint16_t
  */
 fancy_memory_t *fancy_memory_create(void);
 
+/**
+ * @brief A factory method that can be used to instantiate a \ref fancy_memory_t object
+ * that uses a specific allocation \p backend .
+ *
+ * @param backend The allocation backend to be used by the created object.
+ * @return \ref fancy_memory_t* A pointer to the created \ref fancy_memory_t object.
+ * @note Calling \ref fancy_memory_create is equivalent to calling this method with
+ * \ref FANCY_MEMORY_BACKEND_SYSTEM .
+ * @note Passing \ref FANCY_MEMORY_BACKEND_ARENA is equivalent to calling
+ * \ref fancy_memory_create_arena with a 64 KiB chunk size.
+ * @see fancy_memory_backend_t
+ */
+fancy_memory_t *fancy_memory_create_with_backend(fancy_memory_backend_t backend);
+
+/**
+ * @brief A factory method that can be used to instantiate an "arena" \ref fancy_memory_t
+ * object, which bump-allocates memory out of chunks of (at least) \p chunk_size bytes.
+ *
+ * @param chunk_size The usable size of each chunk. Allocations that do not fit into
+ * a chunk of that size get their own, dedicated chunk.
+ * @return \ref fancy_memory_t* A pointer to the created \ref fancy_memory_t object.
+ * @note This mode is meant for memory that is thrown away all at once (e.g., at the end
+ * of a request), using \ref fancy_memory_reset . Freeing individual blocks is supported
+ * (and keeps the tracked totals accurate), but only the space of the most recent block
+ * is ever reused before the next reset. Likewise, \ref fancy_memory_realloc grows or
+ * shrinks the most recent block in place when the current chunk has room for it.
+ * @note Every block is preceded by a small header, which is used to keep track of it,
+ * such that \ref fancy_memory_debug and \ref fancy_memory_get_total keep working.
+ */
+fancy_memory_t *fancy_memory_create_arena(size_t chunk_size);
+
+/**
+ * @brief A factory method that can be used to instantiate a thread-safe \ref fancy_memory_t
+ * object, whose methods can be called concurrently from multiple threads.
+ *
+ * @param shard_count The number of shards (rounded up to a power of two, and capped
+ * to 256) among which the tracked allocations are distributed, based on the address
+ * range (of 1 MiB) they start in.
+ * Passing `0` selects a default based on the number of online processors.
+ * @return \ref fancy_memory_t* A pointer to the created \ref fancy_memory_t object.
+ * @note Each shard has its own lock, and allocations are made (and freed) outside of
+ * those locks, so that threads rarely contend with each other. With allocators that give
+ * each thread its own arena (e.g., glibc's), a thread's blocks mostly fall in shards that
+ * no other thread uses. The statistics of the shards are only merged when they are read
+ * (e.g., using \ref fancy_memory_get_total), which takes time proportional to the number
+ * of shards.
+ * @note Since no global counter is maintained, each shard keeps its own peaks (under its
+ * lock), and the peak values reported by \ref fancy_memory_get_stats are their sums, which
+ * are upper bounds of the actual peaks (the shards need not peak at the same time).
+ * @note A block that moves to another shard when it is reallocated is counted by both
+ * shards until it is tracked by the new one (it is never missing from the totals).
+ * @note Concurrent objects always use the system allocator (i.e.,
+ * \ref FANCY_MEMORY_BACKEND_SYSTEM), and \ref fancy_memory_destroy must not be called
+ * while other threads are still using the object.
+ */
+fancy_memory_t *fancy_memory_create_concurrent(size_t shard_count);
+
+/**
+ * @brief A factory method that can be used to instantiate a \ref fancy_memory_t object
+ * whose totals roll up into those of \p parent (e.g., a request-scoped tracker that is
+ * a child of a connection-scoped tracker, itself a child of a process-wide tracker).
+ *
+ * @param parent A pointer to the \ref fancy_memory_t instance to which the created object
+ * will be attached.
+ * @return \ref fancy_memory_t* A pointer to the created \ref fancy_memory_t object.
+ * @note The child uses the same backend (and arena chunk size, and large threshold) as
+ * \p parent . Blocks are always freed and reallocated using the tracker that allocated
+ * them.
+ * @note The live, peak and cumulative statistics of a tracker (see
+ * \ref fancy_memory_get_total and \ref fancy_memory_get_stats) cover its own blocks
+ * and those of all of its descendants. They are updated eagerly, which costs each
+ * operation time proportional to the depth of the tracker, and retrieving them still
+ * takes constant time. The allocation sites, the histograms and the
+ * \ref fancy_memory_debug output only cover a tracker's own blocks.
+ * @note Destroying a tracker also destroys its descendants, while destroying a child
+ * detaches it (and removes its live blocks from the totals of its ancestors).
+ * @warning Concurrent objects (see \ref fancy_memory_create_concurrent) cannot have
+ * children (for which the process is terminated), and a tree of trackers must only be
+ * used by one thread at a time.
+ * @see fancy_memory_reset_tree, fancy_memory_destroy_tree
+ */
+fancy_memory_t *fancy_memory_create_child(fancy_memory_t *parent);
+
 /**
  * @brief The method that should be used to destroy a \ref fancy_memory_t
  * object once that object is no longer needed.
@@ -76,10 +353,45 @@ fancy_memory_t *fancy_memory_create(void);
  * memory that was allocated using the \ref fancy_memory_malloc and
  * \ref fancy_memory_realloc methods): it will only free the memory used
  * to track that memory (i.e., the memory contained inside the \ref fancy_memory_t
- * object).
+ * object). Use \ref fancy_memory_destroy_tree to free the tracked memory as well.
+ * @note The descendants of \p self (see \ref fancy_memory_create_child), if any, are
+ * destroyed along with it.
+ * @warning The exceptions are the \ref FANCY_MEMORY_BACKEND_POOL backend, for which
+ * every slab is released, such that any still-tracked pooled block (i.e., of up to
+ * 256 bytes) becomes invalid, and the \ref FANCY_MEMORY_BACKEND_ARENA backend, for which
+ * every chunk is released, such that every still-tracked block becomes invalid.
+ * @warning Likewise, the regions backing the blocks allocated using
+ * \ref fancy_memory_handle_alloc are unmapped, such that every handle becomes invalid
+ * and any address returned by \ref fancy_memory_pin (even if still pinned) dangles.
  */
 void fancy_memory_destroy(fancy_memory_t *self);
 
+/**
+ * @brief A method that can be used to free every allocation tracked by \p self and by
+ * all of its descendants (see \ref fancy_memory_create_child), and to then destroy
+ * all of these objects.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be destroyed.
+ * @note Each tracker releases its blocks in a single pass over its own storage (or its
+ * chunks, for arena objects), without looking up any pointer.
+ * @see fancy_memory_reset_tree
+ */
+void fancy_memory_destroy_tree(fancy_memory_t *self);
+
+/**
+ * @brief A method that can be used to presize the internal tracking storage of \p self
+ * such that it can track up to \p n allocations without having to grow.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance for which to reserve storage.
+ * @param n The number of allocations for which storage should be reserved.
+ * @note The internal storage grows geometrically and shrinks only once it is mostly
+ * empty, so calling this method is never required; it simply avoids the growth steps
+ * (e.g., at application startup, when the expected number of allocations is known).
+ * The internal storage will also never shrink below \p n items, until this method is
+ * called again with a smaller value.
+ */
+void fancy_memory_reserve(fancy_memory_t *self, size_t n);
+
 /**
  * @brief The method that must be used to allocate and track new memory.
  *
@@ -94,6 +406,134 @@ void fancy_memory_destroy(fancy_memory_t *self);
  */
 void *fancy_memory_malloc(fancy_memory_t *self, size_t size);
 
+/**
+ * @brief A method that can be used to allocate and track zero-initialized memory for an
+ * array of \p count objects of \p size bytes each.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be used to track
+ * the new memory.
+ * @param count The number of objects.
+ * @param size The size of each object.
+ * @return \ref void* A pointer to the newly allocated (and zeroed) memory.
+ * @note If `count * size` overflows, this method will terminate the process.
+ * @note Large blocks (see \ref fancy_memory_set_large_threshold) are freshly mapped
+ * pages, which the operating system zeroes lazily, so they are never cleared explicitly.
+ * @see fancy_memory_malloc
+ */
+void *fancy_memory_calloc(fancy_memory_t *self, size_t count, size_t size);
+
+/**
+ * @brief A method that can be used to allocate and track memory whose address is a
+ * multiple of \p alignment (e.g., 64 bytes for SIMD buffers, or the page size).
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be used to track
+ * the new memory.
+ * @param alignment The alignment, which must be a power of two.
+ * @param size The size of the memory to be allocated (and returned).
+ * @return \ref void* A pointer to the newly allocated memory.
+ * @note If \p alignment is not a power of two, this method will terminate the process.
+ * @note As with \ref realloc(), reallocating the returned memory does not preserve its
+ * alignment (except for large blocks, which are always page aligned).
+ * @warning Alignments of more than 16 bytes are not supported by the
+ * \ref FANCY_MEMORY_BACKEND_HEADER backend (for which the process is terminated).
+ * @see fancy_memory_malloc
+ */
+void *fancy_memory_aligned_alloc(fancy_memory_t *self, size_t alignment, size_t size);
+
+/**
+ * @brief A method that can be used to serve the allocations of at least \p threshold
+ * bytes directly using `mmap` (e.g., large working buffers), instead of the backend.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be configured.
+ * @param threshold The size (in bytes) from which allocations are mapped, or `0`
+ * (the default) to disable mapping.
+ * @note Mapped blocks of 2 MiB or more are aligned to 2 MiB and advised to be backed by
+ * (transparent) huge pages using `madvise(MADV_HUGEPAGE)`, which reduces TLB misses.
+ * @note Mapped blocks are tracked, freed and reallocated like any other block, and a
+ * block moves between the heap and a mapping when a reallocation crosses the threshold.
+ * Reallocating a mapped block that stays above the threshold uses `mremap`, which moves
+ * (or extends) the mapping by updating page tables, instead of copying its content.
+ * @note Only the \ref FANCY_MEMORY_BACKEND_SYSTEM and \ref FANCY_MEMORY_BACKEND_POOL
+ * backends (and concurrent objects) use mappings. For concurrent objects, this method
+ * must be called before the object is shared with other threads.
+ */
+void fancy_memory_set_large_threshold(fancy_memory_t *self, size_t threshold);
+
+/**
+ * @brief A method that can be used to serve one in every \p rate allocations from a
+ * guarded mapping, such that overflows and use-after-free bugs fault (i.e., `SIGSEGV`)
+ * where they happen, at a cost low enough for production builds.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be configured.
+ * @param rate The sampling rate (e.g., `1` to sample every allocation), or `0` (the
+ * default) to disable sampling.
+ * @note Sampled blocks end right before an inaccessible page, so that reading or writing
+ * past their (16-byte aligned) end faults. Once freed, they are made inaccessible and
+ * quarantined (the last 64 freed ones stay mapped), so that dangling pointers fault as
+ * well. Reallocated sampled blocks always move, and stay sampled.
+ * @note Each sampled block costs (at least) two pages, and a system call or two for
+ * each allocation, free and reallocation, so rates of a few thousand are typical.
+ * @note Only the \ref FANCY_MEMORY_BACKEND_SYSTEM and \ref FANCY_MEMORY_BACKEND_POOL
+ * backends (and concurrent objects) sample allocations, and blocks aligned to more than
+ * a page are never sampled. Concurrent objects count allocations per thread, starting
+ * from a random point of the countdown whenever a thread moves to another concurrent
+ * object, such that one in every \p rate allocations is still sampled (on average) by a
+ * thread that alternates between several objects. Children
+ * (see \ref fancy_memory_create_child) inherit the rate of their parent.
+ */
+void fancy_memory_set_sample_rate(fancy_memory_t *self, size_t rate);
+
+/**
+ * @brief A variant of \ref fancy_memory_malloc that attributes the new memory to the
+ * allocation site identified by \p file , \p line and \p function .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be used to track
+ * the new memory.
+ * @param size The size of the memory to be allocated (and returned).
+ * @param file The name of the source file of the allocation site.
+ * @param line The line of the allocation site.
+ * @param function The name of the function containing the allocation site.
+ * @return \ref void* A pointer to the newly allocated memory.
+ * @note This method is not meant to be called directly; use the \ref FANCY_MEMORY_MALLOC
+ * macro instead, which passes `__FILE__`, `__LINE__` and `__func__`.
+ * @warning \p file and \p function must remain valid for the lifetime of \p self
+ * (string literals, such as `__FILE__` and `__func__`, always do). Sites are told apart
+ * by the addresses of these strings, so that recording a site costs no string comparison.
+ * @see fancy_memory_get_top_sites
+ */
+void *fancy_memory_malloc_at(fancy_memory_t *self, size_t size, char const *file, int line, char const *function);
+
+/**
+ * @brief Allocates (and tracks) \p size bytes using \p self , attributing them to the
+ * calling source location.
+ *
+ * @see fancy_memory_malloc_at
+ */
+#define FANCY_MEMORY_MALLOC(self, size) fancy_memory_malloc_at((self), (size), __FILE__, __LINE__, __func__)
+
+/**
+ * @brief A method that can be used to allocate and track \p n blocks at once (e.g., the
+ * nodes of a tree that is built in a burst), which is cheaper than calling
+ * \ref fancy_memory_malloc \p n times.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be used to track
+ * the new memory.
+ * @param sizes An array of \p n sizes, one for each of the blocks to be allocated.
+ * @param n The number of blocks to be allocated.
+ * @param out An array of (at least) \p n pointers, to which the pointers to the newly
+ * allocated blocks will be written (in the order of \p sizes ).
+ * @note The tracking storage is grown (at most) once for the whole batch, and the
+ * statistics are updated once. With the \ref FANCY_MEMORY_BACKEND_ARENA backend, the
+ * blocks are carved out of a single, contiguous run, while, with the
+ * \ref FANCY_MEMORY_BACKEND_POOL backend, blocks of the same size class are carved out
+ * of a slab contiguously, once that class' previously freed blocks have been reused.
+ * @note For concurrent objects (see \ref fancy_memory_create_concurrent) and the
+ * \ref FANCY_MEMORY_BACKEND_HEADER backend, this is equivalent to calling
+ * \ref fancy_memory_malloc for each block.
+ * @see fancy_memory_free_many
+ */
+void fancy_memory_malloc_many(fancy_memory_t *self, size_t const *sizes, size_t n, void **out);
+
 /**
  * @brief The method that must be used to free (and stop tracking) memory previously allocated
  * using the same \ref fancy_memory_t instance (i.e., the object pointed to by \p self ).
@@ -109,6 +549,181 @@ void *fancy_memory_malloc(fancy_memory_t *self, size_t size);
  */
 void fancy_memory_free(fancy_memory_t *self, void *pointer);
 
+/**
+ * @brief A variant of \ref fancy_memory_free that does nothing (instead of terminating
+ * the process) when \p pointer is not being tracked by \p self .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance that may have been used when
+ * allocating the memory pointed to by \p pointer .
+ * @param pointer A pointer to the memory to be freed.
+ * @return \ref bool `true` if the memory was freed, or `false` if \p pointer is not
+ * being tracked by \p self .
+ * @note This is meant for code that receives pointers from several allocators (e.g.,
+ * the `LD_PRELOAD` shim, see `src/fancy_memory_preload.c`), which can then fall back to
+ * another one, without looking the pointer up twice.
+ * @warning For the \ref FANCY_MEMORY_BACKEND_ARENA and \ref FANCY_MEMORY_BACKEND_HEADER
+ * backends, the memory right in front of \p pointer is read, like with
+ * \ref fancy_memory_free .
+ * @see fancy_memory_try_realloc
+ */
+bool fancy_memory_try_free(fancy_memory_t *self, void *pointer);
+
+/**
+ * @brief A method that can be used to look up the (requested) size of a block, e.g., to
+ * implement `malloc_usable_size` on top of \p self .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance that may have been used when
+ * allocating the memory pointed to by \p pointer .
+ * @param pointer A pointer to the block whose size is looked up.
+ * @param size A pointer to where the size of the block is written (if it is tracked).
+ * @return \ref bool `true` if \p pointer is being tracked by \p self , or `false` otherwise.
+ * @warning For the \ref FANCY_MEMORY_BACKEND_ARENA and \ref FANCY_MEMORY_BACKEND_HEADER
+ * backends, the memory right in front of \p pointer is read, like with
+ * \ref fancy_memory_try_free .
+ * @see fancy_memory_try_free
+ */
+bool fancy_memory_try_get_size(fancy_memory_t *self, void *pointer, size_t *size);
+
+/**
+ * @brief A method that can be used, from any thread, to hand a block back to \p self
+ * (e.g., a message allocated by a producer thread and consumed by another thread),
+ * without waiting for (or locking) \p self .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance that was used when
+ * allocating the memory pointed to by \p pointer .
+ * @param pointer A pointer to the memory to be freed.
+ * @note The block is pushed onto a lock-free queue, and only freed (in batches) by the
+ * next \ref fancy_memory_malloc (or related method) or \ref fancy_memory_collect call
+ * made on \p self by the thread using it. Until then, the block is still counted in the
+ * statistics of \p self .
+ * @note This method may be called concurrently with any other method called on
+ * \p self , except for \ref fancy_memory_destroy .
+ * @warning The first `sizeof(void *)` bytes of the block are overwritten (to link it to
+ * the queue), so blocks of fewer bytes than that must not be passed. Passing a pointer to
+ * memory that was not allocated using \p self will result in the process being
+ * terminated, when the queue is drained.
+ * @see fancy_memory_collect
+ */
+void fancy_memory_free_remote(fancy_memory_t *self, void *pointer);
+
+/**
+ * @brief A method that can be used to free the blocks that were handed back to \p self
+ * using \ref fancy_memory_free_remote , but have not been freed yet.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance whose pending remote frees
+ * should be processed.
+ * @return \ref size_t The number of blocks that were freed.
+ * @note This happens automatically on allocation (as well as on reset and destruction),
+ * so calling this method is only needed to release memory sooner (e.g., when the thread
+ * using \p self becomes idle). Checking for pending frees costs a single (relaxed)
+ * atomic load.
+ */
+size_t fancy_memory_collect(fancy_memory_t *self);
+
+/**
+ * @brief A method that can be used to take every lock of a concurrent \ref fancy_memory_t
+ * instance (e.g., from a `pthread_atfork` "prepare" handler), such that no other thread
+ * is in the middle of an update of \p self when the process forks.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be locked.
+ * @note This does nothing for objects that were not created using
+ * \ref fancy_memory_create_concurrent , which have no locks.
+ * @warning The calling thread must not use \p self until it calls
+ * \ref fancy_memory_unlock_all (e.g., from the "parent" and "child" handlers).
+ * @see fancy_memory_unlock_all
+ */
+void fancy_memory_lock_all(fancy_memory_t *self);
+
+/**
+ * @brief A method that can be used to release the locks taken by \ref fancy_memory_lock_all ,
+ * in the parent process as well as in the child process.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be unlocked.
+ * @see fancy_memory_lock_all
+ */
+void fancy_memory_unlock_all(fancy_memory_t *self);
+
+/**
+ * @brief A method that can be used, from any thread, to enter a read section, within
+ * which the blocks retired from \p self (see \ref fancy_memory_retire) that the thread
+ * can still reach are not freed.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance whose blocks are read.
+ * @note Entering (and exiting) a section costs an atomic compare-and-swap (to claim one of
+ * 64 reader slots, each on its own cache line), a store and a fence, and never locks.
+ * Sections can be nested, and more than 64 threads within sections at once wait for a
+ * slot to be released.
+ * @note This method may be called concurrently with any other method called on
+ * \p self , except for \ref fancy_memory_destroy (and \ref fancy_memory_reset ,
+ * which frees the retired blocks as well).
+ * @see fancy_memory_read_exit, fancy_memory_retire
+ */
+void fancy_memory_read_enter(fancy_memory_t *self);
+
+/**
+ * @brief A method that can be used to exit a read section entered using
+ * \ref fancy_memory_read_enter (by the same thread).
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance whose blocks were read.
+ * @note Pointers to retired blocks obtained within the section must no longer be used.
+ * @note If the calling thread is not within a section, this method will terminate the
+ * process.
+ * @see fancy_memory_read_enter
+ */
+void fancy_memory_read_exit(fancy_memory_t *self);
+
+/**
+ * @brief A method that can be used to free the memory pointed to by \p pointer once no
+ * reader (see \ref fancy_memory_read_enter) can be using it anymore, instead of
+ * waiting for the readers.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance that was used when
+ * allocating the memory pointed to by \p pointer .
+ * @param pointer A pointer to the memory to be retired, which must no longer be
+ * reachable by readers that enter a section from now on (e.g., it was unlinked from a
+ * shared structure).
+ * @note Retired blocks are stamped with the current epoch, and freed in batches (of at
+ * least 64 blocks), once every reader has left the sections it entered at (or before)
+ * that epoch. Until then, they are counted in \ref fancy_memory_stats_t::retired_bytes
+ * (and no longer in \ref fancy_memory_stats_t::live_bytes , or by
+ * \ref fancy_memory_get_total), but are still visited (e.g., by \ref fancy_memory_foreach).
+ * @note If \p pointer is not being tracked by \p self , or has already been retired,
+ * this method will terminate the process. Retired blocks are freed by reclamation only:
+ * freeing (or reallocating) one of them otherwise (e.g., using \ref fancy_memory_free or
+ * \ref fancy_memory_try_free) terminates the process as well.
+ * @see fancy_memory_reclaim
+ */
+void fancy_memory_retire(fancy_memory_t *self, void *pointer);
+
+/**
+ * @brief A method that can be used to advance the epoch, and free the retired blocks
+ * (see \ref fancy_memory_retire) that no reader can be using anymore, without waiting
+ * for a full batch to be pending.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance whose retired blocks
+ * should be processed.
+ * @return \ref size_t The number of blocks that were freed.
+ * @note Blocks retired while a reader is within a section are only freed by a later
+ * call made after that reader has exited it.
+ */
+size_t fancy_memory_reclaim(fancy_memory_t *self);
+
+/**
+ * @brief A method that can be used to free (and stop tracking) \p n blocks at once, which
+ * is cheaper than calling \ref fancy_memory_free \p n times.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance that was used when
+ * allocating the blocks.
+ * @param pointers An array of \p n pointers to the blocks to be freed, which need not
+ * have been allocated using \ref fancy_memory_malloc_many .
+ * @param n The number of blocks to be freed.
+ * @warning Passing a pointer to memory that was not allocated using \p self (or the same
+ * pointer twice) will result in the process being terminated.
+ * @note The statistics are updated once for the whole batch.
+ * @see fancy_memory_malloc_many
+ */
+void fancy_memory_free_many(fancy_memory_t *self, void *const *pointers, size_t n);
+
 /**
  * @brief The method that must be used to reallocate (and update the tracking information of)
  * memory that was initially allocated using the same \ref fancy_memory_t
@@ -129,6 +744,74 @@ void fancy_memory_free(fancy_memory_t *self, void *pointer);
  */
 void *fancy_memory_realloc(fancy_memory_t *self, void *pointer, size_t size);
 
+/**
+ * @brief A variant of \ref fancy_memory_realloc that does nothing (instead of terminating
+ * the process) when \p pointer is not being tracked by \p self .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance that may have been used when
+ * initially allocating the memory pointed to by \p pointer .
+ * @param pointer A pointer to the memory to be reallocated.
+ * @param size The size to be used for the re-allocation.
+ * @return \ref void* A pointer to the re-allocated memory, or the \ref NULL pointer if
+ * \p pointer is not being tracked by \p self (in which case it is left untouched).
+ * @see fancy_memory_try_free
+ */
+void *fancy_memory_try_realloc(fancy_memory_t *self, void *pointer, size_t size);
+
+/**
+ * @brief A variant of \ref fancy_memory_realloc that attributes the reallocated memory
+ * to the allocation site identified by \p file , \p line and \p function .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance that was used when
+ * initially allocating the memory pointed to by \p pointer .
+ * @param pointer A pointer to the memory to be reallocated.
+ * @param size The size to be used for the re-allocation.
+ * @param file The name of the source file of the allocation site.
+ * @param line The line of the allocation site.
+ * @param function The name of the function containing the allocation site.
+ * @return \ref void* A pointer to the re-allocated memory.
+ * @note The block is moved from its previous site (if any) to the given one. A plain
+ * \ref fancy_memory_realloc call keeps the block's previous site instead.
+ * @note This method is not meant to be called directly; use the \ref FANCY_MEMORY_REALLOC
+ * macro instead.
+ * @see fancy_memory_malloc_at
+ */
+void *fancy_memory_realloc_at(fancy_memory_t *self, void *pointer, size_t size, char const *file, int line, char const *function);
+
+/**
+ * @brief Reallocates \p pointer using \p self , attributing it to the calling source
+ * location.
+ *
+ * @see fancy_memory_realloc_at
+ */
+#define FANCY_MEMORY_REALLOC(self, pointer, size) \
+    fancy_memory_realloc_at((self), (pointer), (size), __FILE__, __LINE__, __func__)
+
+/**
+ * @brief The method that can be used to free every allocation currently being tracked
+ * by \p self , which can then be reused as if it had just been created.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be reset.
+ * @note For arena objects (see \ref fancy_memory_create_arena), this takes time
+ * proportional to the number of chunks, which are all released, except for the first
+ * one, which is kept for reuse. For the other backends, every tracked block is freed.
+ * @note The peak and cumulative statistics (see \ref fancy_memory_stats_t) are
+ * preserved, and each freed block counts as a free.
+ * @note Only the blocks of \p self itself are freed, not those of its descendants (see
+ * \ref fancy_memory_reset_tree).
+ */
+void fancy_memory_reset(fancy_memory_t *self);
+
+/**
+ * @brief A variant of \ref fancy_memory_reset that frees every allocation tracked by
+ * \p self and by all of its descendants (see \ref fancy_memory_create_child), which
+ * all remain usable.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be reset.
+ * @see fancy_memory_destroy_tree
+ */
+void fancy_memory_reset_tree(fancy_memory_t *self);
+
 /**
  * @brief A method that can be used to print (i.e., write) a summary of the tracked
  * memory for \p self .
@@ -139,6 +822,68 @@ void *fancy_memory_realloc(fancy_memory_t *self, void *pointer, size_t size);
  */
 void fancy_memory_debug(fancy_memory_t const *self, FILE *stream);
 
+/**
+ * @brief A method that can be used to call \p visitor for each block currently being
+ * tracked by \p self , without allocating or formatting anything.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance whose blocks to visit.
+ * @param visitor The function to be called for each block, which can stop the walk by
+ * returning `false`.
+ * @param context A pointer that is passed, as is, to each \p visitor call.
+ * @return \ref size_t The number of blocks that were visited.
+ * @note The blocks are visited in storage order (i.e., in no particular order, except for
+ * the arena and header backends, which visit them in allocation order). Only the blocks of
+ * \p self itself are visited, not those of its descendants (see
+ * \ref fancy_memory_create_child).
+ * @note For concurrent objects (see \ref fancy_memory_create_concurrent), each shard is
+ * locked while its blocks are being visited.
+ * @see fancy_memory_foreach_in_range, fancy_memory_iterator_init
+ */
+size_t fancy_memory_foreach(fancy_memory_t const *self, fancy_memory_visitor_t visitor, void *context);
+
+/**
+ * @brief A variant of \ref fancy_memory_foreach that only visits the blocks whose size is
+ * in the range `[min_size, max_size]`.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance whose blocks to visit.
+ * @param min_size The smallest size of the blocks to be visited.
+ * @param max_size The largest size of the blocks to be visited.
+ * @param visitor The function to be called for each matching block.
+ * @param context A pointer that is passed, as is, to each \p visitor call.
+ * @return \ref size_t The number of blocks that were visited.
+ */
+size_t fancy_memory_foreach_in_range(
+    fancy_memory_t const *self, size_t min_size, size_t max_size, fancy_memory_visitor_t visitor, void *context);
+
+/**
+ * @brief A method that can be used to initialize \p iterator such that it walks over the
+ * blocks tracked by \p self whose size is in the range `[min_size, max_size]` (i.e.,
+ * `0` and `SIZE_MAX` to walk over every block).
+ *
+ * @param iterator A pointer to the \ref fancy_memory_iterator_t object to be initialized.
+ * @param self A pointer to the \ref fancy_memory_t instance whose blocks to walk over.
+ * @param min_size The smallest size of the blocks to be returned.
+ * @param max_size The largest size of the blocks to be returned.
+ * @warning \p self must not be modified (e.g., by allocating or freeing memory) until the
+ * iterator is no longer used. Concurrent objects are the exception, since each step locks
+ * the current shard, but blocks allocated or freed during the walk may then be missed (or
+ * returned twice).
+ * @see fancy_memory_iterator_next, fancy_memory_foreach
+ */
+void fancy_memory_iterator_init(fancy_memory_iterator_t *iterator, fancy_memory_t const *self, size_t min_size, size_t max_size);
+
+/**
+ * @brief A method that can be used to advance \p iterator to the next matching block.
+ *
+ * @param iterator A pointer to a \ref fancy_memory_iterator_t object initialized using
+ * \ref fancy_memory_iterator_init .
+ * @param block A pointer to the \ref fancy_memory_block_t object to which the next block
+ * will be written.
+ * @return \ref bool `true` if a block was written to \p block , or `false` if there are no
+ * more blocks (in which case the walk can simply be abandoned, as it holds no resource).
+ */
+bool fancy_memory_iterator_next(fancy_memory_iterator_t *iterator, fancy_memory_block_t *block);
+
 /**
  * @brief The method that must be used to retrieve the total amount of memory (in bytes)
  * currently being tracked by the \ref fancy_memory_t object \p self .
@@ -147,9 +892,177 @@ void fancy_memory_debug(fancy_memory_t const *self, FILE *stream);
  * to total memory usage.
  * @return \ref size_t The total number of bytes currently being tracked (i.e., that
  * have been allocated but not yet freed) using \p self .
+ * @note This method runs in constant time.
  */
 size_t fancy_memory_get_total(fancy_memory_t const *self);
 
+/**
+ * @brief A method that can be used to retrieve a snapshot of the statistics
+ * (i.e., live, peak and cumulative counters) maintained by \p self .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance for which to retrieve
+ * the statistics.
+ * @param stats A pointer to the \ref fancy_memory_stats_t object to which the
+ * statistics will be written.
+ * @note This method runs in constant time, which makes it suitable for frequent
+ * polling (e.g., from a metrics collection loop).
+ * @see fancy_memory_get_total
+ */
+void fancy_memory_get_stats(fancy_memory_t const *self, fancy_memory_stats_t *stats);
+
+/**
+ * @brief A method that can be used to retrieve the size and lifetime histograms (e.g., in
+ * order to pick pool size classes or arena chunk sizes) maintained by \p self .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance for which to retrieve
+ * the histograms.
+ * @param histograms A pointer to the \ref fancy_memory_histograms_t object to which the
+ * histograms will be written.
+ * @note The histograms use a fixed amount of memory, and are updated in constant time
+ * by each operation. They are also included in the \ref fancy_memory_debug output.
+ */
+void fancy_memory_get_histograms(fancy_memory_t const *self, fancy_memory_histograms_t *histograms);
+
+/**
+ * @brief A method that can be used to find the allocation sites currently holding the
+ * most memory.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance for which to retrieve
+ * the allocation sites.
+ * @param sites A pointer to an array of (at least) \p n \ref fancy_memory_site_stats_t
+ * objects, to which the sites will be written, by decreasing number of live bytes
+ * (and then of allocated bytes).
+ * @param n The maximum number of sites to be written.
+ * @return \ref size_t The number of sites written to \p sites .
+ * @note Only memory allocated using \ref FANCY_MEMORY_MALLOC or \ref FANCY_MEMORY_REALLOC
+ * (or the methods behind them) is attributed to a site.
+ * @note This method takes time proportional to the number of distinct sites (not to the
+ * number of tracked allocations), and allocates temporary memory.
+ */
+size_t fancy_memory_get_top_sites(fancy_memory_t const *self, fancy_memory_site_stats_t *sites, size_t n);
+
+/**
+ * @brief A method that can be used to write a compact, binary snapshot of the memory
+ * tracked by \p self (i.e., the statistics, histograms, allocation sites, and the
+ * address and size of every tracked allocation) to \p stream .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance for which to write a snapshot.
+ * @param stream A pointer to a writable stream (e.g., a file pointer to a binary file,
+ * opened using the `"wb"` mode) to which to write the snapshot.
+ * @return \ref bool `true` if the snapshot was written, or `false` if writing to
+ * \p stream failed.
+ * @note Unlike \ref fancy_memory_debug , the snapshot is written through a large
+ * buffer, using 16 bytes per allocation, which makes this method suitable for capturing
+ * the state of large trackers (e.g., from a live process).
+ * @note The format is versioned and documented in the implementation file. Two snapshots
+ * can be compared using the `fancy_memory_snapshot` tool (see `tools/snapshot.c`).
+ * @note Like \ref fancy_memory_get_stats , the totals and the allocations written leave
+ * out the retired blocks (see \ref fancy_memory_retire) still pending.
+ * @note For concurrent objects, the shards are written one at a time (each under its
+ * lock), after the statistics, such that allocations made by other threads in the
+ * meantime may be missing from (or only present in) the allocations written.
+ */
+bool fancy_memory_snapshot_write(fancy_memory_t const *self, FILE *stream);
+
+/**
+ * @brief A method that can be used to publish the counters of \p self (i.e., its
+ * statistics, as well as its number of live blocks per size bucket) into a POSIX shared
+ * memory object named \p name , which external processes can then read at any time,
+ * without locking (or calling into) the tracker.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be published.
+ * @param name The name of the shared memory object (e.g., `"/my_application"`; see
+ * `shm_open`), which is created by this method, and must not exist yet.
+ * @return \ref bool `true` if the object was created, or `false` otherwise (in which case
+ * `errno` is set by the failing system call, e.g., to `EEXIST` if an object named \p name
+ * already exists, which is then left untouched).
+ * @note An object left behind by a process that did not exit cleanly (e.g., that crashed)
+ * keeps its name taken until it is removed (e.g., using `shm_unlink`, or from
+ * `/dev/shm` on Linux).
+ * @note Once published, each operation updates the object using a few relaxed stores.
+ * The object is removed by \ref fancy_memory_unpublish (or \ref fancy_memory_destroy),
+ * and its layout is documented in the implementation file. It can be read using the
+ * `fancy_memory_monitor` tool (see `tools/monitor.c`).
+ * @note Only the blocks of \p self itself are counted (i.e., not those of its
+ * descendants, which can be published under their own names). For concurrent objects,
+ * each shard is published separately, and the peaks are those of the shards.
+ * @note Like \ref fancy_memory_get_stats , the published live bytes and count leave out
+ * the retired blocks (see \ref fancy_memory_retire) still pending, which are only
+ * counted in the size buckets.
+ */
+bool fancy_memory_publish(fancy_memory_t *self, char const *name);
+
+/**
+ * @brief A method that can be used to stop publishing the counters of \p self , and to
+ * remove the shared memory object created by \ref fancy_memory_publish (if any).
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be unpublished.
+ */
+void fancy_memory_unpublish(fancy_memory_t *self);
+
+/**
+ * @brief A method that can be used to allocate (and track) \p size bytes of memory that
+ * are referred to by a handle, instead of an address, such that the block can be moved
+ * by \ref fancy_memory_compact whenever it is not pinned.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance that will track the block.
+ * @param size The size of the block, in bytes.
+ * @return \ref fancy_memory_handle_t The block's handle, which is valid until it is passed
+ * to \ref fancy_memory_handle_free (or \p self is reset or destroyed).
+ * @note Blocks allocated through handles are counted in the statistics like any other
+ * block, and are aligned on 16 bytes. Their memory is mapped in large regions, separately
+ * from the backend's.
+ * @note The program will terminate with an error if \p self is a concurrent object (see
+ * \ref fancy_memory_create_concurrent).
+ */
+fancy_memory_handle_t fancy_memory_handle_alloc(fancy_memory_t *self, size_t size);
+
+/**
+ * @brief A method that can be used to free the block referred to by \p handle .
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance tracking the block.
+ * @param handle The block's handle, as returned by \ref fancy_memory_handle_alloc .
+ * @note The program will terminate with an error if \p handle is not a valid handle of
+ * \p self , or if the block is pinned.
+ */
+void fancy_memory_handle_free(fancy_memory_t *self, fancy_memory_handle_t handle);
+
+/**
+ * @brief A method that can be used to pin the block referred to by \p handle (i.e., to
+ * prevent it from moving) and to retrieve its current address.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance tracking the block.
+ * @param handle The block's handle.
+ * @return \ref void* The block's address, which remains valid until the block is unpinned
+ * (i.e., until \ref fancy_memory_unpin has been called once for each call to this method).
+ */
+void *fancy_memory_pin(fancy_memory_t *self, fancy_memory_handle_t handle);
+
+/**
+ * @brief A method that can be used to unpin the block referred to by \p handle , after
+ * which the address returned by \ref fancy_memory_pin must no longer be used.
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance tracking the block.
+ * @param handle The block's handle.
+ */
+void fancy_memory_unpin(fancy_memory_t *self, fancy_memory_handle_t handle);
+
+/**
+ * @brief A method that can be used to compact the blocks allocated through handles, by
+ * moving the unpinned blocks out of sparsely used regions, and by returning the pages of
+ * the regions left empty to the system (using `madvise`).
+ *
+ * @param self A pointer to the \ref fancy_memory_t instance to be compacted.
+ * @param budget The (approximate) amount of time, in nanoseconds, that this call may
+ * spend compacting.
+ * @return \ref bool `true` if compaction is complete, or `false` if the budget ran out
+ * first, in which case the next call resumes where this one stopped (e.g., during the
+ * next idle period).
+ * @note Regions that keep pinned blocks are only retried during the next compaction
+ * (i.e., after this method has returned `true`).
+ */
+bool fancy_memory_compact(fancy_memory_t *self, uint64_t budget);
+
 /**
  * @example examples/demo.c
  *
@@ -21,6 +21,21 @@
     THE SOFTWARE.
 */
 
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
 #include "fancy_memory.h"
 
 #define __FANCY_MEMORY_LIB_VERSION_MAJOR__ 0
@@ -31,15 +46,620 @@
     fprintf(stderr, "[%s:%d] ERROR: %s\n", __func__, __LINE__, message); \
     exit(EXIT_FAILURE)
 
+/*
+    The address index is an open-addressing (linear probing) hash table that maps
+    a tracked address to its position inside the `entries` array.
+    Deletion uses backward shifting, so no tombstones are ever left behind, and
+    resizing is incremental: when the table needs to grow (or shrink), a new table
+    is allocated and the old one is drained a few slots at a time by subsequent
+    insertions and deletions, such that no single operation pays for a full rehash.
+    Shrinking waits for any pending migration to finish, and the step is large enough
+    for a migration to always finish before the next growth: after a resize to K slots,
+    the old table has at most 2K slots (and K/4 items) to go through, while growing again
+    takes at least K/4 more insertions, hence a step of (at least) 9 slots. Tables of
+    FANCY_MEMORY_INDEX_MAPPED_SIZE bytes or more are mapped, such that they are zeroed
+    lazily (`calloc` may clear them all at once, after consolidating the heap's free
+    chunks). Once a migration has gone past a huge page of slots (which are then empty,
+    and never written again), that page is released, such that unmapping the old table
+    at the end of the migration is cheap as well. Tables of up to
+    FANCY_MEMORY_INDEX_SHRINK_MIN_CAPACITY slots (16 KiB) never shrink, since a tracker
+    (or shard) cycling through a handful of blocks would otherwise resize on every cycle.
+*/
+#define FANCY_MEMORY_INDEX_MIN_CAPACITY (16)
+#define FANCY_MEMORY_INDEX_SHRINK_MIN_CAPACITY (1024)
+#define FANCY_MEMORY_INDEX_MIGRATION_STEP (16)
+#define FANCY_MEMORY_INDEX_MAPPED_SIZE (64 * 1024)
+
+/*
+    The `entries` array grows geometrically (doubling) and only shrinks (halving)
+    once it is less than a quarter full, such that alternating allocations and
+    frees around a capacity boundary never trigger repeated reallocations.
+*/
+#define FANCY_MEMORY_ENTRIES_MIN_CAPACITY (16)
+
+typedef struct
+{
+    void *pointer;
+    size_t size;
+    fancy_memory_site_stats_t *site;
+    uint64_t birth;
+    unsigned int kind;
+    bool retired;
+} fancy_memory_private_entry_t;
+
+/*
+    The kind of an entry tells which allocator owns its block: for the "default" kind,
+    that is decided by the backend and the block's size (i.e., the pool, or `malloc`),
+    while "system" blocks (e.g., over-aligned ones) are always owned by `malloc` (i.e.,
+    released using `free`), and "mapped" blocks (i.e., large ones, see
+    `fancy_memory_set_large_threshold`) are owned by `mmap`, like "guarded" blocks (i.e.,
+    sampled ones, see `fancy_memory_set_sample_rate`), which end right before a guard page.
+*/
+#define FANCY_MEMORY_KIND_DEFAULT (0)
+#define FANCY_MEMORY_KIND_SYSTEM (1)
+#define FANCY_MEMORY_KIND_MAPPED (2)
+#define FANCY_MEMORY_KIND_GUARDED (3)
+
+// The alignment guaranteed by `malloc` (and by the pool and arena backends).
+#define FANCY_MEMORY_DEFAULT_ALIGNMENT (16)
+// Mapped blocks of at least this size are aligned to it and backed by huge pages.
+#define FANCY_MEMORY_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct
+{
+    void *key;
+    size_t value;
+} fancy_memory_private_slot_t;
+
+typedef struct
+{
+    fancy_memory_private_slot_t *slots;
+    size_t capacity;
+    size_t count;
+    unsigned int bits;
+} fancy_memory_private_table_t;
+
+/*
+    The pool backend serves requests of up to FANCY_MEMORY_POOL_MAX_SIZE bytes from
+    fixed size classes, whose blocks are carved out of large, class-specific slabs.
+    Freed blocks are kept on per-class (intrusive) free lists, and slabs are only
+    released, all at once, when the tracker is destroyed. Larger requests fall back
+    to the system allocator.
+*/
+#define FANCY_MEMORY_POOL_MAX_SIZE (256)
+#define FANCY_MEMORY_POOL_CLASS_COUNT (12)
+#define FANCY_MEMORY_POOL_SLAB_SIZE (64 * 1024)
+#define FANCY_MEMORY_POOL_ALIGNMENT (16)
+
+typedef struct fancy_memory_private_slab_s
+{
+    struct fancy_memory_private_slab_s *next;
+} fancy_memory_private_slab_t;
+
+typedef struct
+{
+    void *free_lists[FANCY_MEMORY_POOL_CLASS_COUNT];
+    char *cursors[FANCY_MEMORY_POOL_CLASS_COUNT];
+    char *limits[FANCY_MEMORY_POOL_CLASS_COUNT];
+    fancy_memory_private_slab_t *slabs;
+} fancy_memory_private_pool_t;
+
+static size_t const fancy_memory_private_pool_class_sizes[FANCY_MEMORY_POOL_CLASS_COUNT] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256};
+
+/*
+    Blocks that are not tracked through the `entries` array (i.e., those of the arena
+    and header backends) are preceded by an inline header, which holds the block's size,
+    a tag identifying the owning tracker (cleared once the block is freed, and whose
+    lowest bit is set once the block is retired), and the links of an intrusive list
+    of live blocks (in allocation order), which is used when walking the blocks.
+*/
+#define FANCY_MEMORY_HEADER_MAGIC ((uintptr_t)0x5AFEC0DEF00DBA5EULL)
+#define FANCY_MEMORY_HEADER_RETIRED ((uintptr_t)1)
+
+typedef struct fancy_memory_private_header_s
+{
+    _Alignas(16) struct fancy_memory_private_header_s *previous;
+    struct fancy_memory_private_header_s *next;
+    size_t size;
+    uintptr_t tag;
+    fancy_memory_site_stats_t *site;
+    uint64_t birth;
+} fancy_memory_private_header_t;
+
+_Static_assert(sizeof(fancy_memory_private_header_t) % 16 == 0, "Headers must preserve 16-byte alignment.");
+
+/*
+    The arena backend bump-allocates header-prefixed blocks out of chunks. Freeing the
+    most recent block (or reallocating it, when the current chunk has room) rolls the
+    bump cursor back (or forward), while freeing any other block only unlinks it.
+    Chunks are only released by `fancy_memory_reset` (which keeps the first chunk for
+    reuse) and `fancy_memory_destroy`.
+*/
+#define FANCY_MEMORY_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+#define FANCY_MEMORY_ARENA_ALIGNMENT (16)
+
+typedef struct fancy_memory_private_chunk_s
+{
+    struct fancy_memory_private_chunk_s *next;
+    size_t size;
+} fancy_memory_private_chunk_t;
+
+_Static_assert(sizeof(fancy_memory_private_chunk_t) % 16 == 0, "Chunks must preserve 16-byte alignment.");
+
+typedef struct
+{
+    size_t chunk_size;
+    fancy_memory_private_chunk_t *chunks;
+    char *cursor;
+    char *limit;
+    fancy_memory_private_header_t *last;
+} fancy_memory_private_arena_t;
+
+/*
+    Allocation sites (i.e., `__FILE__`, `__LINE__` and `__func__` triples) are interned
+    into a per-tracker, open-addressing table of individually allocated (hence stable)
+    records, keyed by the identity of the triple's members, and each tracked block
+    only stores a pointer to its site's record. The most recently used site is cached,
+    since consecutive allocations very often come from the same call site.
+*/
+#define FANCY_MEMORY_SITES_MIN_CAPACITY (64)
+
+typedef struct
+{
+    char const *file;
+    int line;
+    char const *function;
+} fancy_memory_private_location_t;
+
+typedef struct
+{
+    fancy_memory_site_stats_t **slots;
+    size_t capacity;
+    size_t count;
+    fancy_memory_site_stats_t *last;
+} fancy_memory_private_sites_t;
+
+/*
+    A concurrent tracker owns a power-of-two number of shards, each of which is a
+    regular (system backend) tracker protected by its own lock. A block belongs to
+    the shard selected by hashing the address range (of 1 MiB) it starts in, with a
+    different multiplier than the one used by the address index. Allocators that give
+    each thread its own arena (e.g., glibc's) carve a thread's blocks out of the same
+    few ranges, so each thread mostly keeps to shards (and cache lines) of its own,
+    while the free path still finds the shard from the address alone. Blocks are
+    obtained from, and returned to, the system allocator outside of the shard locks,
+    and the statistics of the shards are only merged when they are read.
+*/
+#define FANCY_MEMORY_SHARDS_MAX_COUNT (256)
+#define FANCY_MEMORY_SHARD_RANGE_BITS (20)
+#define FANCY_MEMORY_CACHE_LINE_SIZE (64)
+
+typedef struct
+{
+    _Alignas(FANCY_MEMORY_CACHE_LINE_SIZE) pthread_mutex_t lock;
+    fancy_memory_t *tracker;
+} fancy_memory_private_shard_t;
+
+typedef struct
+{
+    size_t count;
+    unsigned int bits;
+    fancy_memory_private_shard_t *items;
+    pthread_mutex_t stats_lock;
+} fancy_memory_private_shards_t;
+
+/*
+    Blocks allocated through handles (see `fancy_memory_handle_alloc`) are bump-allocated
+    out of dedicated, mapped regions, behind a small header naming their record (or 0,
+    once freed). Handles are indices into a table of records, tagged with a generation
+    (such that stale handles are detected), and each record holds the current address
+    of its block and its pin count, such that unpinned blocks can be moved.
+    Compaction evacuates the sparse regions (i.e., those less than half live, except the
+    current one) into the current region, one region at a time, and remembers where it
+    stopped, such that it can be spread over many calls. Regions left without any live
+    block give their pages back to the system (using `madvise`), but stay mapped, for
+    reuse. Each region is visited once per compaction pass, such that regions holding
+    pinned blocks are not walked over and over again.
+*/
+#define FANCY_MEMORY_REGION_SIZE (1024 * 1024)
+#define FANCY_MEMORY_HANDLE_ALIGNMENT (16)
+// The number of blocks walked by compaction between two reads of the clock.
+#define FANCY_MEMORY_COMPACTION_CLOCK_INTERVAL (16)
+
+typedef struct
+{
+    uint64_t record;
+    uint64_t length;
+} fancy_memory_private_block_t;
+
+_Static_assert(sizeof(fancy_memory_private_block_t) % FANCY_MEMORY_HANDLE_ALIGNMENT == 0, "Blocks must preserve 16-byte alignment.");
+
+typedef struct
+{
+    char *base;
+    size_t size;
+    size_t cursor;
+    size_t live_length;
+    size_t live_count;
+    uint64_t pass;
+} fancy_memory_private_region_t;
+
+typedef struct
+{
+    fancy_memory_private_block_t *block;
+    size_t size;
+    size_t region;
+    uint64_t birth;
+    uint32_t generation;
+    uint32_t pins;
+    size_t next_free;
+} fancy_memory_private_record_t;
+
+typedef struct
+{
+    fancy_memory_private_record_t *records;
+    size_t capacity;
+    size_t used;
+    size_t free_list;
+    size_t count;
+    fancy_memory_private_region_t *regions;
+    size_t region_count;
+    size_t region_capacity;
+    size_t active;
+    size_t source;
+    size_t offset;
+    uint64_t pass;
+} fancy_memory_private_handles_t;
+
+/*
+    Sampled blocks (see `fancy_memory_set_sample_rate`) get their own mapping, whose last
+    page is made inaccessible (i.e., `PROT_NONE`), and are placed such that they end
+    right before it. The sampling decision is a countdown, which is set to SIZE_MAX when
+    sampling is disabled, such that unsampled calls only ever pay for a decrement (and
+    a branch). Concurrent trackers count down per thread instead, which keeps the shards
+    independent. The thread's countdown belongs to the last concurrent tracker it used,
+    and restarts (at a position spread over the whole rate, such that alternating
+    between trackers neither starves one of them nor samples in lockstep) when the
+    thread moves to another one. Freed sampled blocks are made entirely inaccessible and
+    quarantined (i.e., kept mapped, in a FIFO ring of FANCY_MEMORY_QUARANTINE_SIZE blocks),
+    such that their addresses are not reused while dangling pointers to them may still be
+    used.
+*/
+#define FANCY_MEMORY_QUARANTINE_SIZE (64)
+
+typedef struct
+{
+    void *pointers[FANCY_MEMORY_QUARANTINE_SIZE];
+    size_t sizes[FANCY_MEMORY_QUARANTINE_SIZE];
+    size_t count;
+    size_t next;
+} fancy_memory_private_quarantine_t;
+
+typedef struct
+{
+    fancy_memory_t const *tracker;
+    size_t countdown;
+    uint64_t restarts;
+} fancy_memory_private_sampler_t;
+
+static _Thread_local fancy_memory_private_sampler_t fancy_memory_private_sampler = {0};
+
+/*
+    Retired blocks (see `fancy_memory_retire`) are reclaimed using epochs. Readers
+    publish the global epoch they observed, in one of FANCY_MEMORY_READER_SLOTS slots
+    (each on its own cache line, which a reader claims for the duration of its outermost
+    critical section), while retired blocks are stamped with the epoch at which they
+    were retired. Once FANCY_MEMORY_RETIRE_BATCH_SIZE more blocks are pending, the epoch
+    is advanced and the blocks retired before the oldest epoch still published (if any)
+    are freed at once. Retired blocks stay tracked (e.g., they are still visited), but
+    leave the live totals right away (see `fancy_memory_stats_t::retired_bytes`).
+*/
+#define FANCY_MEMORY_READER_SLOTS (64)
+#define FANCY_MEMORY_RETIRE_BATCH_SIZE (64)
+
+typedef struct
+{
+    _Alignas(64) _Atomic(uint64_t) epoch;
+    _Atomic(uintptr_t) owner;
+    size_t depth;
+} fancy_memory_private_reader_t;
+
+typedef struct
+{
+    void *pointer;
+    size_t size;
+    uint64_t epoch;
+} fancy_memory_private_retired_t;
+
+typedef struct
+{
+    _Atomic(uint64_t) epoch;
+    _Atomic(fancy_memory_private_reader_t *) readers;
+    fancy_memory_private_retired_t *items;
+    size_t count;
+    size_t capacity;
+    size_t threshold;
+} fancy_memory_private_epochs_t;
+
+/*
+    The address of this (per thread) variable identifies the slots claimed by a thread,
+    while the hint remembers the last slot it used, along with its tracker. A thread
+    never claims a slot of the hint's tracker other than the hinted one, such that an
+    outermost section only costs a compare-and-swap on that slot (unless it was claimed
+    by another thread in the meantime).
+*/
+static _Thread_local char fancy_memory_private_reader_id;
+static _Thread_local struct
+{
+    fancy_memory_t const *tracker;
+    size_t slot;
+} fancy_memory_private_reader_hint = {NULL, 0};
+
+/*
+    Child trackers (see `fancy_memory_create_child`) form a tree, whose links are kept
+    in each tracker (i.e., a parent, the first child, and doubly linked siblings). The
+    `stats` of a tracker only cover its own blocks, while its `descendants` hold the
+    totals of all of its descendants, which every operation updates along the path to
+    the root. The peaks of `descendants` are those of the whole subtree (i.e., of the
+    tracker's own blocks and those of its descendants).
+*/
+
+/*
+    Remote frees (see `fancy_memory_free_remote`) are pushed onto an intrusive, lock-free
+    stack, whose links are stored in the first bytes of the freed blocks themselves. The
+    owning thread takes the whole stack at once (i.e., by exchanging its head with the
+    NULL pointer), which is why the usual ABA problem of lock-free stacks cannot happen,
+    and frees its blocks in batches of up to FANCY_MEMORY_REMOTE_BATCH_SIZE pointers.
+*/
+#define FANCY_MEMORY_REMOTE_BATCH_SIZE (64)
+
+/*
+    Walking the blocks (see `fancy_memory_foreach` and `fancy_memory_iterator_next`)
+    reads the `entries` array (or the header list) in place. The iterator keeps the
+    position of the next entry (or the next header, once `position` is non-zero), and,
+    for concurrent trackers, the shard it is in, whose lock it holds for one step only.
+    `fancy_memory_debug` is written on top of the same walk.
+*/
+typedef struct
+{
+    FILE *stream;
+    size_t index;
+    size_t total_size;
+} fancy_memory_private_debug_context_t;
+
+/*
+    Published trackers (see `fancy_memory_publish`) mirror their counters into a shared
+    memory object, laid out as follows (in native byte order, since its readers run on
+    the same machine):
+
+        header (magic ("FANCYSHM", 8 bytes), version, process ID, backend, slot count,
+            bucket count),
+        slots (one per shard for concurrent trackers, one otherwise, each starting on
+            its own cache line): sequence, live bytes, live count, peak bytes, peak
+            count, allocation count, free count, reallocation count, and the number of
+            live blocks per size bucket (see `fancy_memory_histograms_t`).
+
+    Like `fancy_memory_get_stats`, the live bytes and count leave out the retired blocks
+    still pending, while the size buckets count every tracked block.
+
+    Each slot is a seqlock with a single writer (i.e., its tracker, or its shard, under
+    the shard's lock), which makes the sequence odd before updating the slot and even
+    again after, using relaxed stores ordered by a release fence and a release store.
+    Readers retry until they read the same even sequence before and after copying the
+    slot, such that they never block (or slow down) the writer.
+*/
+#define FANCY_MEMORY_SHM_MAGIC "FANCYSHM"
+#define FANCY_MEMORY_SHM_VERSION (1)
+
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Published counters must be lock-free, since they are shared with other processes.");
+
+typedef struct
+{
+    _Alignas(FANCY_MEMORY_CACHE_LINE_SIZE) _Atomic(uint64_t) sequence;
+    _Atomic(uint64_t) live_bytes;
+    _Atomic(uint64_t) live_count;
+    _Atomic(uint64_t) peak_bytes;
+    _Atomic(uint64_t) peak_count;
+    _Atomic(uint64_t) allocation_count;
+    _Atomic(uint64_t) free_count;
+    _Atomic(uint64_t) reallocation_count;
+    _Atomic(uint64_t) live_counts[FANCY_MEMORY_HISTOGRAM_BUCKETS];
+} fancy_memory_private_shm_slot_t;
+
+typedef struct
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t pid;
+    uint64_t backend;
+    uint64_t slot_count;
+    uint64_t bucket_count;
+    fancy_memory_private_shm_slot_t slots[];
+} fancy_memory_private_shm_page_t;
+
+typedef struct
+{
+    fancy_memory_private_shm_page_t *page;
+    size_t size;
+    char *name;
+} fancy_memory_private_shm_t;
+
+/*
+    Snapshots are written through a large buffer (instead of one `fprintf` call per
+    allocation), using the following versioned format, in which every integer is stored
+    as a little-endian, unsigned 64-bit value (except where noted otherwise):
+
+        magic ("FANCYMEM", 8 bytes), version, backend, shard count (0 if not concurrent),
+        stats (live bytes, live count, peak bytes, peak count, allocation count,
+            free count, reallocation count),
+        bucket count, size histogram buckets, lifetime histogram buckets,
+        site count, sites (file, line, function, live bytes, live count,
+            allocation count, allocated bytes),
+        entry blocks (count, followed by as many address and size pairs), the last
+            of which is empty (i.e., has a count of 0).
+
+    Strings are stored as a length followed by that many bytes (without the trailing
+    `\0`). Entries are written in blocks so that the shards of a concurrent tracker can
+    be written one at a time, without knowing the total number of entries beforehand.
+    Since the other threads keep running meanwhile, the number of entries of a concurrent
+    tracker may differ from its live count (which is read first).
+*/
+#define FANCY_MEMORY_SNAPSHOT_MAGIC "FANCYMEM"
+#define FANCY_MEMORY_SNAPSHOT_VERSION (1)
+#define FANCY_MEMORY_SNAPSHOT_BUFFER_SIZE (1024 * 1024)
+
+typedef struct
+{
+    FILE *stream;
+    unsigned char *buffer;
+    size_t length;
+    bool failed;
+} fancy_memory_private_writer_t;
+
 static size_t fancy_memory_private_member_next_index(fancy_memory_t *self);
+static void fancy_memory_private_member_set_capacity(fancy_memory_t *self, size_t capacity);
+static void *fancy_memory_private_member_malloc(
+    fancy_memory_t *self, size_t size, size_t alignment, bool zeroed, fancy_memory_private_location_t const *location);
+static bool fancy_memory_private_member_free(fancy_memory_t *self, void *pointer, bool retired);
+static void fancy_memory_private_member_free_many(fancy_memory_t *self, void *const *pointers, size_t n, bool retired);
+static void *fancy_memory_private_member_realloc(fancy_memory_t *self, void *pointer, size_t size, fancy_memory_private_location_t const *location);
+static void *fancy_memory_private_member_acquire(fancy_memory_t *self, size_t size, size_t alignment, bool zeroed, unsigned int *kind);
+static void fancy_memory_private_member_release(fancy_memory_t *self, void *pointer, size_t size, unsigned int kind);
+static void *fancy_memory_private_member_resize(fancy_memory_t *self, void *pointer, size_t old_size, size_t new_size, unsigned int *kind);
+static void *fancy_memory_private_system_acquire(size_t size, size_t alignment, bool zeroed, size_t threshold, unsigned int *kind);
+static void fancy_memory_private_system_release(void *pointer, size_t size, unsigned int kind);
+static void *fancy_memory_private_system_resize(void *pointer, size_t old_size, size_t new_size, size_t threshold, unsigned int *kind);
+static void *fancy_memory_private_map(size_t size, size_t alignment);
+static bool fancy_memory_private_member_sampled(fancy_memory_t *self, size_t alignment);
+static void *fancy_memory_private_guarded_acquire(size_t size, size_t alignment);
+static void fancy_memory_private_guarded_release(void *pointer, size_t size, bool quarantined);
+static void *fancy_memory_private_member_guarded_resize(fancy_memory_t *self, void *pointer, size_t old_size, size_t new_size);
+static void fancy_memory_private_member_quarantine(fancy_memory_t *self, void *pointer, size_t size);
+static size_t fancy_memory_private_mapped_length(size_t size);
+static void *fancy_memory_private_member_pool_acquire(fancy_memory_t *self, size_t class_index);
+static size_t fancy_memory_private_pool_class_of(size_t size);
+static fancy_memory_private_header_t *fancy_memory_private_member_arena_carve(
+    fancy_memory_t *self, size_t size, size_t alignment, fancy_memory_site_stats_t *site);
+static void fancy_memory_private_member_arena_free(fancy_memory_t *self, void *pointer, char const *message);
+static void *fancy_memory_private_member_arena_realloc(fancy_memory_t *self, void *pointer, size_t size, fancy_memory_private_location_t const *location);
+static void fancy_memory_private_member_arena_reset(fancy_memory_t *self);
+static void *fancy_memory_private_member_header_malloc(fancy_memory_t *self, size_t size, bool zeroed, fancy_memory_site_stats_t *site);
+static void fancy_memory_private_member_header_free(fancy_memory_t *self, void *pointer);
+static void *fancy_memory_private_member_header_realloc(fancy_memory_t *self, void *pointer, size_t size, fancy_memory_private_location_t const *location);
+static void fancy_memory_private_member_header_reset(fancy_memory_t *self);
+static void fancy_memory_private_member_arena_add_chunk(fancy_memory_t *self, size_t size);
+static fancy_memory_private_header_t *fancy_memory_private_member_header_of(fancy_memory_t *self, void *pointer, char const *message);
+static bool fancy_memory_private_member_owns_header(fancy_memory_t const *self, void const *pointer);
+static void fancy_memory_private_member_header_link(fancy_memory_t *self, fancy_memory_private_header_t *header);
+static void fancy_memory_private_member_header_unlink(fancy_memory_t *self, fancy_memory_private_header_t *header);
+static fancy_memory_private_record_t *fancy_memory_private_member_record_of(fancy_memory_t *self, fancy_memory_handle_t handle);
+static size_t fancy_memory_private_member_record_take(fancy_memory_t *self);
+static fancy_memory_private_block_t *fancy_memory_private_member_region_carve(fancy_memory_t *self, size_t length, size_t excluded, size_t *region);
+static void fancy_memory_private_member_region_release(fancy_memory_t *self, size_t region);
+static void fancy_memory_private_member_handles_reset(fancy_memory_t *self);
+static uint64_t fancy_memory_private_now(void);
+static size_t fancy_memory_private_align(size_t size, size_t alignment);
+static void fancy_memory_private_member_account_alloc(fancy_memory_t *self, size_t size, fancy_memory_site_stats_t *site);
+static void fancy_memory_private_member_account_alloc_many(fancy_memory_t *self, size_t const *sizes, size_t count);
+static void fancy_memory_private_member_account_free(fancy_memory_t *self, size_t size, fancy_memory_site_stats_t *site, uint64_t birth);
+static uint64_t fancy_memory_private_member_clock(fancy_memory_t const *self);
+static size_t fancy_memory_private_bucket_of(uint64_t value);
+static void fancy_memory_private_histogram_debug(uint64_t const *buckets, char const *name, FILE *stream);
+static void fancy_memory_private_member_account_realloc(
+    fancy_memory_t *self, size_t old_size, size_t new_size, fancy_memory_site_stats_t *old_site, fancy_memory_site_stats_t *new_site);
+static void fancy_memory_private_member_roll_up(
+    fancy_memory_t *self, size_t bytes, size_t count, uint64_t allocations, uint64_t frees, uint64_t reallocations);
+static void fancy_memory_private_member_detach(fancy_memory_t *self);
+static size_t fancy_memory_private_member_drain(fancy_memory_t *self);
+static fancy_memory_private_reader_t *fancy_memory_private_member_reader_of(fancy_memory_t *self);
+static fancy_memory_private_reader_t *fancy_memory_private_member_reader_find(fancy_memory_t *self);
+static fancy_memory_private_reader_t *fancy_memory_private_member_reader_claim(fancy_memory_t *self);
+static size_t fancy_memory_private_member_reclaim(fancy_memory_t *self, bool forced);
+static void fancy_memory_private_member_retired_count(fancy_memory_t *self, size_t bytes, size_t count);
+static void fancy_memory_private_member_retired_clear(fancy_memory_t *self);
+static size_t fancy_memory_private_member_size_of(fancy_memory_t *self, void *pointer);
+static size_t fancy_memory_private_member_retire_mark(fancy_memory_t *self, void *pointer);
+static fancy_memory_site_stats_t *fancy_memory_private_member_site_of(fancy_memory_t *self, fancy_memory_private_location_t const *location);
+static void fancy_memory_private_member_sites_insert(fancy_memory_t *self, fancy_memory_site_stats_t *site);
+static size_t fancy_memory_private_sites_home(fancy_memory_private_sites_t const *sites, fancy_memory_private_location_t const *location);
+static size_t fancy_memory_private_member_collect_sites(fancy_memory_t const *self, fancy_memory_site_stats_t *sites, size_t count);
+static int fancy_memory_private_compare_site_locations(void const *a, void const *b);
+static int fancy_memory_private_compare_site_live_bytes(void const *a, void const *b);
 static ssize_t fancy_memory_private_member_index_of(fancy_memory_t *self, void *pointer);
-static void fancy_memory_private_member_remove(fancy_memory_t *self, size_t index);
+static void fancy_memory_private_member_track(fancy_memory_t *self, void *pointer, size_t size, unsigned int kind, fancy_memory_site_stats_t *site);
+static void fancy_memory_private_member_untrack(fancy_memory_t *self, size_t index);
+static fancy_memory_private_shard_t *fancy_memory_private_member_shard_of(fancy_memory_t const *self, uintptr_t address);
+static void *fancy_memory_private_member_concurrent_malloc(
+    fancy_memory_t *self, size_t size, size_t alignment, bool zeroed, fancy_memory_private_location_t const *location);
+static bool fancy_memory_private_member_concurrent_free(fancy_memory_t *self, void *pointer, bool retired);
+static size_t fancy_memory_private_member_concurrent_retire(fancy_memory_t *self, void *pointer);
+static void *fancy_memory_private_member_concurrent_realloc(fancy_memory_t *self, void *pointer, size_t size, fancy_memory_private_location_t const *location);
+static void fancy_memory_private_member_account_leave(fancy_memory_t *self, size_t size, fancy_memory_site_stats_t *site);
+static void fancy_memory_private_member_concurrent_stats(fancy_memory_t const *self, fancy_memory_stats_t *stats);
+static void fancy_memory_private_member_concurrent_debug(fancy_memory_t const *self, FILE *stream);
+static bool fancy_memory_private_member_visit(
+    fancy_memory_t const *self, size_t min_size, size_t max_size, fancy_memory_visitor_t visitor, void *context, size_t *count);
+static bool fancy_memory_private_member_visit_handles(
+    fancy_memory_t const *self, size_t min_size, size_t max_size, fancy_memory_visitor_t visitor, void *context, size_t *count);
+static bool fancy_memory_private_member_step(fancy_memory_t const *self, fancy_memory_iterator_t *iterator, fancy_memory_block_t *block);
+static bool fancy_memory_private_debug_block(fancy_memory_block_t const *block, void *context);
+static void fancy_memory_private_member_shm_refresh(fancy_memory_t *self);
+static bool fancy_memory_private_shm_count_block(fancy_memory_block_t const *block, void *context);
+static void fancy_memory_private_shm_begin(fancy_memory_private_shm_slot_t *slot);
+static void fancy_memory_private_shm_count(fancy_memory_private_shm_slot_t *slot, size_t size, uint64_t delta);
+static void fancy_memory_private_shm_end(fancy_memory_private_shm_slot_t *slot, fancy_memory_stats_t const *stats);
+static void fancy_memory_private_member_snapshot_entries(fancy_memory_t const *self, fancy_memory_private_writer_t *writer);
+static void fancy_memory_private_writer_bytes(fancy_memory_private_writer_t *writer, void const *bytes, size_t size);
+static void fancy_memory_private_writer_u64(fancy_memory_private_writer_t *writer, uint64_t value);
+static void fancy_memory_private_writer_string(fancy_memory_private_writer_t *writer, char const *string);
+static void fancy_memory_private_writer_flush(fancy_memory_private_writer_t *writer);
+static void fancy_memory_private_lock(pthread_mutex_t *lock);
+static void fancy_memory_private_unlock(pthread_mutex_t *lock);
+static void fancy_memory_private_member_index_insert(fancy_memory_t *self, void *key, size_t value);
+static fancy_memory_private_slot_t *fancy_memory_private_member_index_find(fancy_memory_t *self, void const *key);
+static void fancy_memory_private_member_index_erase(fancy_memory_t *self, void const *key);
+static void fancy_memory_private_member_index_resize(fancy_memory_t *self, size_t capacity);
+static void fancy_memory_private_member_index_migrate(fancy_memory_t *self, size_t budget);
+static void fancy_memory_private_table_init(fancy_memory_private_table_t *table, size_t capacity);
+static void fancy_memory_private_table_release(fancy_memory_private_table_t *table);
+static size_t fancy_memory_private_table_home(fancy_memory_private_table_t const *table, void const *key);
+static ssize_t fancy_memory_private_table_position_of(fancy_memory_private_table_t const *table, void const *key);
+static void fancy_memory_private_table_insert(fancy_memory_private_table_t *table, void *key, size_t value);
+static void fancy_memory_private_table_erase_at(fancy_memory_private_table_t *table, size_t position);
 
 struct fancy_memory_s
 {
+    fancy_memory_backend_t backend;
     size_t n;
-    void **pointers;
-    size_t *sizes;
+    size_t capacity;
+    size_t reserved;
+    fancy_memory_private_entry_t *entries;
+    fancy_memory_private_table_t index;
+    fancy_memory_private_table_t previous_index;
+    size_t migration_position;
+    fancy_memory_stats_t stats;
+    fancy_memory_histograms_t histograms;
+    fancy_memory_private_pool_t pool;
+    fancy_memory_private_arena_t arena;
+    fancy_memory_private_header_t *head;
+    fancy_memory_private_header_t *tail;
+    fancy_memory_private_shards_t *shards;
+    fancy_memory_private_sites_t sites;
+    size_t large_threshold;
+    fancy_memory_t *parent;
+    fancy_memory_t *children;
+    fancy_memory_t *previous_sibling;
+    fancy_memory_t *next_sibling;
+    fancy_memory_stats_t descendants;
+    _Atomic(void *) remote_frees;
+    fancy_memory_private_shm_t shm;
+    fancy_memory_private_shm_slot_t *shm_slot;
+    fancy_memory_private_handles_t handles;
+    size_t sample_rate;
+    size_t sample_countdown;
+    fancy_memory_private_quarantine_t quarantine;
+    fancy_memory_private_epochs_t epochs;
 };
 
 void fancy_memory_get_library_version(uint16_t *major, uint16_t *minor, uint16_t *revision)
@@ -51,173 +671,3366 @@ void fancy_memory_get_library_version(uint16_t *major, uint16_t *minor, uint16_t
 
 fancy_memory_t *fancy_memory_create(void)
 {
+    return fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_SYSTEM);
+}
+
+fancy_memory_t *fancy_memory_create_with_backend(fancy_memory_backend_t backend)
+{
+    if (backend == FANCY_MEMORY_BACKEND_ARENA)
+    {
+        return fancy_memory_create_arena(FANCY_MEMORY_ARENA_DEFAULT_CHUNK_SIZE);
+    }
+    if (backend != FANCY_MEMORY_BACKEND_SYSTEM && backend != FANCY_MEMORY_BACKEND_POOL &&
+        backend != FANCY_MEMORY_BACKEND_HEADER)
+    {
+        FAIL_AND_TERMINATE("Unknown backend.");
+    }
     fancy_memory_t *self = malloc(sizeof(fancy_memory_t));
     if (self == NULL)
     {
         FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
     }
+    self->backend = backend;
     self->n = 0;
-    self->pointers = NULL;
-    self->sizes = NULL;
+    self->capacity = 0;
+    self->reserved = 0;
+    self->entries = NULL;
+    fancy_memory_private_table_init(&self->index, 0);
+    fancy_memory_private_table_init(&self->previous_index, 0);
+    self->migration_position = 0;
+    self->stats = (fancy_memory_stats_t){0};
+    self->pool = (fancy_memory_private_pool_t){0};
+    self->arena = (fancy_memory_private_arena_t){0};
+    self->head = NULL;
+    self->tail = NULL;
+    self->shards = NULL;
+    self->sites = (fancy_memory_private_sites_t){0};
+    self->histograms = (fancy_memory_histograms_t){0};
+    self->large_threshold = 0;
+    self->parent = NULL;
+    self->children = NULL;
+    self->previous_sibling = NULL;
+    self->next_sibling = NULL;
+    self->descendants = (fancy_memory_stats_t){0};
+    atomic_init(&self->remote_frees, NULL);
+    self->shm = (fancy_memory_private_shm_t){0};
+    self->shm_slot = NULL;
+    self->handles = (fancy_memory_private_handles_t){.active = SIZE_MAX, .source = SIZE_MAX, .pass = 1};
+    self->sample_rate = 0;
+    self->sample_countdown = SIZE_MAX;
+    self->quarantine = (fancy_memory_private_quarantine_t){0};
+    atomic_init(&self->epochs.epoch, 1);
+    atomic_init(&self->epochs.readers, NULL);
+    self->epochs.items = NULL;
+    self->epochs.count = 0;
+    self->epochs.capacity = 0;
+    self->epochs.threshold = FANCY_MEMORY_RETIRE_BATCH_SIZE;
+    return self;
+}
+
+fancy_memory_t *fancy_memory_create_arena(size_t chunk_size)
+{
+    if (chunk_size == 0)
+    {
+        FAIL_AND_TERMINATE("The chunk size must be greater than zero.");
+    }
+    fancy_memory_t *self = fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_SYSTEM);
+    self->backend = FANCY_MEMORY_BACKEND_ARENA;
+    self->arena.chunk_size = sizeof(fancy_memory_private_chunk_t) +
+                             fancy_memory_private_align(chunk_size, FANCY_MEMORY_ARENA_ALIGNMENT);
+    fancy_memory_private_member_arena_add_chunk(self, self->arena.chunk_size);
+    return self;
+}
+
+fancy_memory_t *fancy_memory_create_concurrent(size_t shard_count)
+{
+    if (shard_count == 0)
+    {
+        long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+        shard_count = 4 * (size_t)(processor_count > 0 ? processor_count : 1);
+    }
+    if (shard_count > FANCY_MEMORY_SHARDS_MAX_COUNT)
+    {
+        shard_count = FANCY_MEMORY_SHARDS_MAX_COUNT;
+    }
+    fancy_memory_t *self = fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_SYSTEM);
+    fancy_memory_private_shards_t *shards = malloc(sizeof(fancy_memory_private_shards_t));
+    if (shards == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+    }
+    shards->count = 1;
+    shards->bits = 0;
+    while (shards->count < shard_count)
+    {
+        shards->count *= 2;
+        shards->bits += 1;
+    }
+    shards->items = aligned_alloc(FANCY_MEMORY_CACHE_LINE_SIZE, sizeof(fancy_memory_private_shard_t) * shards->count);
+    if (shards->items == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'aligned_alloc' returned the NULL pointer.");
+    }
+    for (size_t i = 0; i < shards->count; i++)
+    {
+        if (pthread_mutex_init(&shards->items[i].lock, NULL) != 0)
+        {
+            FAIL_AND_TERMINATE("Call to 'pthread_mutex_init' failed.");
+        }
+        shards->items[i].tracker = fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_SYSTEM);
+    }
+    if (pthread_mutex_init(&shards->stats_lock, NULL) != 0)
+    {
+        FAIL_AND_TERMINATE("Call to 'pthread_mutex_init' failed.");
+    }
+    self->shards = shards;
+    return self;
+}
+
+fancy_memory_t *fancy_memory_create_child(fancy_memory_t *parent)
+{
+    if (parent->shards != NULL)
+    {
+        FAIL_AND_TERMINATE("Concurrent objects cannot have children.");
+    }
+    fancy_memory_t *self = parent->backend == FANCY_MEMORY_BACKEND_ARENA
+                               ? fancy_memory_create_arena(parent->arena.chunk_size - sizeof(fancy_memory_private_chunk_t))
+                               : fancy_memory_create_with_backend(parent->backend);
+    self->large_threshold = parent->large_threshold;
+    fancy_memory_set_sample_rate(self, parent->sample_rate);
+    self->parent = parent;
+    self->next_sibling = parent->children;
+    if (parent->children != NULL)
+    {
+        parent->children->previous_sibling = self;
+    }
+    parent->children = self;
     return self;
 }
 
 void fancy_memory_destroy(fancy_memory_t *self)
 {
-    if (self->sizes != NULL)
+    // Pending remote frees are honoured, since their blocks' links would otherwise
+    // make them look like live (but corrupted) blocks.
+    fancy_memory_private_member_drain(self);
+    fancy_memory_unpublish(self);
+    while (self->children != NULL)
+    {
+        // Children unlink themselves from `self` (their totals are dropped along with it).
+        fancy_memory_destroy(self->children);
+    }
+    if (self->parent != NULL)
+    {
+        fancy_memory_private_member_detach(self);
+    }
+    if (self->shards != NULL)
+    {
+        for (size_t i = 0; i < self->shards->count; i++)
+        {
+            pthread_mutex_destroy(&self->shards->items[i].lock);
+            fancy_memory_destroy(self->shards->items[i].tracker);
+        }
+        pthread_mutex_destroy(&self->shards->stats_lock);
+        free(self->shards->items);
+        free(self->shards);
+        self->shards = NULL;
+    }
+    if (self->entries != NULL)
+    {
+        free(self->entries);
+        self->entries = NULL;
+    }
+    fancy_memory_private_table_release(&self->index);
+    fancy_memory_private_table_release(&self->previous_index);
+    while (self->pool.slabs != NULL)
+    {
+        fancy_memory_private_slab_t *next = self->pool.slabs->next;
+        free(self->pool.slabs);
+        self->pool.slabs = next;
+    }
+    while (self->arena.chunks != NULL)
+    {
+        fancy_memory_private_chunk_t *next = self->arena.chunks->next;
+        free(self->arena.chunks);
+        self->arena.chunks = next;
+    }
+    fancy_memory_private_member_handles_reset(self);
+    free(self->handles.records);
+    free(self->handles.regions);
+    for (size_t i = 0; i < self->quarantine.count; i++)
     {
-        free(self->sizes);
-        self->sizes = NULL;
+        fancy_memory_private_guarded_release(self->quarantine.pointers[i], self->quarantine.sizes[i], true);
     }
-    if (self->pointers != NULL)
+    free(self->epochs.items);
+    free(atomic_load_explicit(&self->epochs.readers, memory_order_relaxed));
+    for (size_t i = 0; i < self->sites.capacity; i++)
     {
-        free(self->pointers);
-        self->pointers = NULL;
+        free(self->sites.slots[i]);
     }
+    free(self->sites.slots);
     free(self);
 }
 
 void *fancy_memory_malloc(fancy_memory_t *self, size_t size)
 {
-    void *pointer = malloc(size);
-    if (pointer == NULL)
+    return fancy_memory_private_member_malloc(self, size, FANCY_MEMORY_DEFAULT_ALIGNMENT, false, NULL);
+}
+
+void *fancy_memory_malloc_at(fancy_memory_t *self, size_t size, char const *file, int line, char const *function)
+{
+    fancy_memory_private_location_t location = {file, line, function};
+    return fancy_memory_private_member_malloc(self, size, FANCY_MEMORY_DEFAULT_ALIGNMENT, false, &location);
+}
+
+void *fancy_memory_calloc(fancy_memory_t *self, size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
     {
-        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+        FAIL_AND_TERMINATE("The total size passed to 'fancy_memory_calloc' overflows 'size_t'.");
     }
-    size_t next_index = fancy_memory_private_member_next_index(self);
-    self->pointers[next_index] = pointer;
-    self->sizes[next_index] = size;
-    return pointer;
+    return fancy_memory_private_member_malloc(self, count * size, FANCY_MEMORY_DEFAULT_ALIGNMENT, true, NULL);
 }
 
-void fancy_memory_free(fancy_memory_t *self, void *pointer)
+void *fancy_memory_aligned_alloc(fancy_memory_t *self, size_t alignment, size_t size)
 {
-    ssize_t index = fancy_memory_private_member_index_of(self, pointer);
-    if (index == -1)
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
     {
-        FAIL_AND_TERMINATE("Trying to free memory for address that is not being tracked by the specified instance.");
+        FAIL_AND_TERMINATE("The alignment passed to 'fancy_memory_aligned_alloc' is not a power of two.");
     }
-    fancy_memory_private_member_remove(self, (size_t)index);
+    return fancy_memory_private_member_malloc(
+        self, size, alignment < FANCY_MEMORY_DEFAULT_ALIGNMENT ? FANCY_MEMORY_DEFAULT_ALIGNMENT : alignment, false, NULL);
 }
 
-void *fancy_memory_realloc(fancy_memory_t *self, void *pointer, size_t size)
+void fancy_memory_set_large_threshold(fancy_memory_t *self, size_t threshold)
 {
-    ssize_t index = fancy_memory_private_member_index_of(self, pointer);
-    if (index == -1)
+    self->large_threshold = threshold;
+}
+
+void fancy_memory_set_sample_rate(fancy_memory_t *self, size_t rate)
+{
+    self->sample_rate = rate;
+    self->sample_countdown = rate == 0 ? SIZE_MAX : rate;
+}
+
+void fancy_memory_free(fancy_memory_t *self, void *pointer)
+{
+    if (!fancy_memory_private_member_free(self, pointer, false))
     {
-        FAIL_AND_TERMINATE("Trying to reallocate memory for address that is not being tracked by the specified instance.");
+        FAIL_AND_TERMINATE("Trying to free memory for address that is not being tracked by the specified instance.");
     }
-    self->pointers[index] = realloc(self->pointers[index], size);
-    if (self->pointers[index] == NULL)
+}
+
+bool fancy_memory_try_free(fancy_memory_t *self, void *pointer)
+{
+    return fancy_memory_private_member_free(self, pointer, false);
+}
+
+void fancy_memory_destroy_tree(fancy_memory_t *self)
+{
+    fancy_memory_reset_tree(self);
+    fancy_memory_destroy(self);
+}
+
+bool fancy_memory_try_get_size(fancy_memory_t *self, void *pointer, size_t *size)
+{
+    if (self->shards == NULL)
     {
-        FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+        *size = fancy_memory_private_member_size_of(self, pointer);
+        return *size != SIZE_MAX;
     }
-    self->sizes[index] = size;
-    return self->pointers[index];
+    fancy_memory_private_shard_t *shard = fancy_memory_private_member_shard_of(self, (uintptr_t)pointer);
+    fancy_memory_private_lock(&shard->lock);
+    *size = fancy_memory_private_member_size_of(shard->tracker, pointer);
+    fancy_memory_private_unlock(&shard->lock);
+    return *size != SIZE_MAX;
 }
 
-void fancy_memory_debug(fancy_memory_t const *self, FILE *stream)
+void fancy_memory_lock_all(fancy_memory_t *self)
 {
-    if (self->n == 0)
+    // No code path takes a shard lock while holding the statistics lock, so taking the
+    // latter last (and releasing it first) cannot deadlock.
+    if (self->shards == NULL)
     {
-        fprintf(stream, "\nfancy_memory_t[%zu] {} [total size = 0]\n\n", self->n);
         return;
     }
-    size_t total_size = 0;
-    fprintf(stream, "\nfancy_memory_t[%zu] {\n", self->n);
-    for (size_t i = 0; i < self->n; i++)
+    for (size_t i = 0; i < self->shards->count; i++)
     {
-        fprintf(stream, "\t.[%zu] = { address = %p, size = %zu },\n", i, self->pointers[i], self->sizes[i]);
-        total_size += self->sizes[i];
+        fancy_memory_private_lock(&self->shards->items[i].lock);
     }
-    fprintf(stream, "} [total size = %zu]\n\n", total_size);
+    fancy_memory_private_lock(&self->shards->stats_lock);
 }
 
-size_t fancy_memory_get_total(fancy_memory_t const *self)
+void fancy_memory_unlock_all(fancy_memory_t *self)
 {
-    size_t total_size = 0;
-    for (size_t i = 0; i < self->n; i++)
+    if (self->shards == NULL)
     {
-        total_size += self->sizes[i];
+        return;
+    }
+    fancy_memory_private_unlock(&self->shards->stats_lock);
+    for (size_t i = self->shards->count; i > 0; i--)
+    {
+        fancy_memory_private_unlock(&self->shards->items[i - 1].lock);
     }
-    return total_size;
 }
 
-static size_t fancy_memory_private_member_next_index(fancy_memory_t *self)
+void fancy_memory_free_remote(fancy_memory_t *self, void *pointer)
 {
-    size_t index = self->n;
-    self->n += 1;
-    if (index == 0)
+    void *head = atomic_load_explicit(&self->remote_frees, memory_order_relaxed);
+    do
     {
-        self->pointers = malloc(sizeof(void **));
-        if (self->pointers == NULL)
-        {
-            FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
-        }
-        self->sizes = malloc(sizeof(size_t));
-        if (self->sizes == NULL)
-        {
-            FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
-        }
-    }
-    else
+        *(void **)pointer = head;
+    } while (!atomic_compare_exchange_weak_explicit(&self->remote_frees, &head, pointer, memory_order_release, memory_order_relaxed));
+}
+
+size_t fancy_memory_collect(fancy_memory_t *self)
+{
+    return fancy_memory_private_member_drain(self);
+}
+
+void fancy_memory_read_enter(fancy_memory_t *self)
+{
+    fancy_memory_private_reader_t *reader = fancy_memory_private_member_reader_claim(self);
+    if (reader->depth++ == 0)
     {
-        self->pointers = realloc(self->pointers, sizeof(void **) * self->n);
-        if (self->pointers == NULL)
-        {
-            FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
-        }
-        self->sizes = realloc(self->sizes, sizeof(size_t) * self->n);
-        if (self->sizes == NULL)
-        {
-            FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
-        }
+        // The fence orders the publication of the epoch before the reads made within
+        // the section (see `fancy_memory_private_member_reclaim`).
+        atomic_store_explicit(&reader->epoch, atomic_load(&self->epochs.epoch), memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
     }
-    return index;
 }
 
-static ssize_t fancy_memory_private_member_index_of(fancy_memory_t *self, void *pointer)
+void fancy_memory_read_exit(fancy_memory_t *self)
 {
-    for (size_t i = 0; i < self->n; i++)
+    fancy_memory_private_reader_t *reader = fancy_memory_private_member_reader_find(self);
+    if (reader == NULL)
     {
-        if (self->pointers[i] == pointer)
-        {
-            return i;
-        }
+        FAIL_AND_TERMINATE("Trying to exit a read section that was never entered.");
+    }
+    if (--reader->depth == 0)
+    {
+        atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+        atomic_store_explicit(&reader->owner, 0, memory_order_release);
     }
-    return -1;
 }
 
-static void fancy_memory_private_member_remove(fancy_memory_t *self, size_t index)
+void fancy_memory_retire(fancy_memory_t *self, void *pointer)
 {
-    if (self->n == 1)
+    // Concurrent trackers count their retired blocks in the blocks' shards (see
+    // `fancy_memory_private_member_concurrent_retire`), while the others do it here.
+    size_t size = self->shards != NULL ? fancy_memory_private_member_concurrent_retire(self, pointer)
+                                       : fancy_memory_private_member_retire_mark(self, pointer);
+    if (size == SIZE_MAX)
     {
-        free(self->pointers[0]);
-        free(self->pointers);
-        free(self->sizes);
-        self->pointers = NULL;
-        self->sizes = NULL;
-        self->n = 0;
-        return;
+        FAIL_AND_TERMINATE("Trying to retire memory for address that is not being tracked by the specified instance.");
     }
-
-    free(self->pointers[index]);
-
-    for (size_t i = index + 1; i < self->n; i++)
+    fancy_memory_private_epochs_t *epochs = &self->epochs;
+    if (self->shards != NULL)
     {
-        self->pointers[i - 1] = self->pointers[i];
-        self->sizes[i - 1] = self->sizes[i];
+        fancy_memory_private_lock(&self->shards->stats_lock);
     }
-
-    self->n -= 1;
-    self->pointers = realloc(self->pointers, sizeof(void **) * self->n);
-    if (self->pointers == NULL)
+    if (epochs->count == epochs->capacity)
     {
-        FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+        size_t capacity = epochs->capacity == 0 ? FANCY_MEMORY_RETIRE_BATCH_SIZE : epochs->capacity * 2;
+        fancy_memory_private_retired_t *items = realloc(epochs->items, sizeof(fancy_memory_private_retired_t) * capacity);
+        if (items == NULL)
+        {
+            FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+        }
+        epochs->items = items;
+        epochs->capacity = capacity;
     }
-    self->sizes = realloc(self->sizes, sizeof(size_t) * self->n);
-    if (self->sizes == NULL)
+    epochs->items[epochs->count++] =
+        (fancy_memory_private_retired_t){.pointer = pointer, .size = size, .epoch = atomic_load(&epochs->epoch)};
+    if (self->shards != NULL)
     {
-        FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+        fancy_memory_private_unlock(&self->shards->stats_lock);
+    }
+    else
+    {
+        fancy_memory_private_member_retired_count(self, size, 1);
+    }
+    fancy_memory_private_member_reclaim(self, false);
+}
+
+size_t fancy_memory_reclaim(fancy_memory_t *self)
+{
+    return fancy_memory_private_member_reclaim(self, true);
+}
+
+void fancy_memory_malloc_many(fancy_memory_t *self, size_t const *sizes, size_t n, void **out)
+{
+    fancy_memory_private_member_drain(self);
+    if (self->shards != NULL || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = fancy_memory_private_member_malloc(self, sizes[i], FANCY_MEMORY_DEFAULT_ALIGNMENT, false, NULL);
+        }
+        return;
+    }
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA)
+    {
+        // The chunk is sized for the whole batch, such that its blocks are carved out
+        // of a single, contiguous run.
+        size_t needed = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            needed += sizeof(fancy_memory_private_header_t) + fancy_memory_private_align(sizes[i], FANCY_MEMORY_ARENA_ALIGNMENT);
+        }
+        if ((size_t)(self->arena.limit - self->arena.cursor) < needed)
+        {
+            size_t chunk_size = sizeof(fancy_memory_private_chunk_t) + needed;
+            fancy_memory_private_member_arena_add_chunk(self, chunk_size < self->arena.chunk_size ? self->arena.chunk_size : chunk_size);
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = fancy_memory_private_member_arena_carve(self, sizes[i], FANCY_MEMORY_DEFAULT_ALIGNMENT, NULL) + 1;
+        }
+        fancy_memory_private_member_account_alloc_many(self, sizes, n);
+        return;
+    }
+    // The entries and the index are grown (at most) once for the whole batch.
+    if (self->n + n > self->capacity)
+    {
+        size_t capacity = self->capacity * 2;
+        if (capacity < self->n + n)
+        {
+            capacity = self->n + n;
+        }
+        fancy_memory_private_member_set_capacity(
+            self, capacity < FANCY_MEMORY_ENTRIES_MIN_CAPACITY ? FANCY_MEMORY_ENTRIES_MIN_CAPACITY : capacity);
+    }
+    size_t count = self->index.count + self->previous_index.count + n;
+    if (count * 2 > self->index.capacity)
+    {
+        size_t index_capacity = FANCY_MEMORY_INDEX_MIN_CAPACITY;
+        while (index_capacity < count * 2)
+        {
+            index_capacity *= 2;
+        }
+        // Like reserving, a batch may as well finish a pending migration first.
+        fancy_memory_private_member_index_migrate(self, SIZE_MAX);
+        fancy_memory_private_member_index_resize(self, index_capacity);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        // Pooled blocks of the same class are carved out of a slab contiguously (once
+        // that class' free list is empty).
+        unsigned int kind;
+        out[i] = fancy_memory_private_member_acquire(self, sizes[i], FANCY_MEMORY_DEFAULT_ALIGNMENT, false, &kind);
+        fancy_memory_private_member_track(self, out[i], sizes[i], kind, NULL);
+    }
+    fancy_memory_private_member_account_alloc_many(self, sizes, n);
+}
+
+void fancy_memory_free_many(fancy_memory_t *self, void *const *pointers, size_t n)
+{
+    fancy_memory_private_member_free_many(self, pointers, n, false);
+}
+
+void *fancy_memory_realloc(fancy_memory_t *self, void *pointer, size_t size)
+{
+    void *new_pointer = fancy_memory_private_member_realloc(self, pointer, size, NULL);
+    if (new_pointer == NULL)
+    {
+        FAIL_AND_TERMINATE("Trying to reallocate memory for address that is not being tracked by the specified instance.");
+    }
+    return new_pointer;
+}
+
+void *fancy_memory_try_realloc(fancy_memory_t *self, void *pointer, size_t size)
+{
+    return fancy_memory_private_member_realloc(self, pointer, size, NULL);
+}
+
+void *fancy_memory_realloc_at(fancy_memory_t *self, void *pointer, size_t size, char const *file, int line, char const *function)
+{
+    fancy_memory_private_location_t location = {file, line, function};
+    void *new_pointer = fancy_memory_private_member_realloc(self, pointer, size, &location);
+    if (new_pointer == NULL)
+    {
+        FAIL_AND_TERMINATE("Trying to reallocate memory for address that is not being tracked by the specified instance.");
+    }
+    return new_pointer;
+}
+
+void fancy_memory_debug(fancy_memory_t const *self, FILE *stream)
+{
+    if (self->shards != NULL)
+    {
+        fancy_memory_private_member_concurrent_debug(self, stream);
+        return;
+    }
+    if (self->stats.live_count == 0)
+    {
+        fprintf(stream, "\nfancy_memory_t[%zu] {} [total size = 0]\n\n", self->stats.live_count);
+        fancy_memory_private_histogram_debug(self->histograms.sizes, "sizes [bytes]", stream);
+        fancy_memory_private_histogram_debug(self->histograms.lifetimes, "lifetimes [operations]", stream);
+        return;
+    }
+    fprintf(stream, "\nfancy_memory_t[%zu] {\n", self->stats.live_count);
+    fancy_memory_private_debug_context_t context = {.stream = stream, .index = 0, .total_size = 0};
+    fancy_memory_foreach(self, fancy_memory_private_debug_block, &context);
+    fprintf(stream, "} [total size = %zu]\n\n", self->stats.live_bytes);
+    fancy_memory_private_histogram_debug(self->histograms.sizes, "sizes [bytes]", stream);
+    fancy_memory_private_histogram_debug(self->histograms.lifetimes, "lifetimes [operations]", stream);
+}
+
+size_t fancy_memory_foreach(fancy_memory_t const *self, fancy_memory_visitor_t visitor, void *context)
+{
+    return fancy_memory_foreach_in_range(self, 0, SIZE_MAX, visitor, context);
+}
+
+size_t fancy_memory_foreach_in_range(
+    fancy_memory_t const *self, size_t min_size, size_t max_size, fancy_memory_visitor_t visitor, void *context)
+{
+    size_t count = 0;
+    if (self->shards == NULL)
+    {
+        fancy_memory_private_member_visit(self, min_size, max_size, visitor, context, &count);
+        return count;
+    }
+    for (size_t i = 0; i < self->shards->count; i++)
+    {
+        fancy_memory_private_lock(&self->shards->items[i].lock);
+        bool more = fancy_memory_private_member_visit(self->shards->items[i].tracker, min_size, max_size, visitor, context, &count);
+        fancy_memory_private_unlock(&self->shards->items[i].lock);
+        if (!more)
+        {
+            break;
+        }
+    }
+    return count;
+}
+
+void fancy_memory_iterator_init(fancy_memory_iterator_t *iterator, fancy_memory_t const *self, size_t min_size, size_t max_size)
+{
+    iterator->tracker = self;
+    iterator->min_size = min_size;
+    iterator->max_size = max_size;
+    iterator->shard = 0;
+    iterator->position = 0;
+    iterator->header = NULL;
+    iterator->handle = 0;
+}
+
+bool fancy_memory_iterator_next(fancy_memory_iterator_t *iterator, fancy_memory_block_t *block)
+{
+    fancy_memory_t const *self = iterator->tracker;
+    if (self->shards == NULL)
+    {
+        return fancy_memory_private_member_step(self, iterator, block);
+    }
+    while (iterator->shard < self->shards->count)
+    {
+        fancy_memory_private_shard_t *shard = &self->shards->items[iterator->shard];
+        fancy_memory_private_lock(&shard->lock);
+        bool found = fancy_memory_private_member_step(shard->tracker, iterator, block);
+        fancy_memory_private_unlock(&shard->lock);
+        if (found)
+        {
+            return true;
+        }
+        iterator->shard++;
+        iterator->position = 0;
+    }
+    return false;
+}
+
+bool fancy_memory_publish(fancy_memory_t *self, char const *name)
+{
+    fancy_memory_unpublish(self);
+    size_t slot_count = self->shards != NULL ? self->shards->count : 1;
+    size_t size = sizeof(fancy_memory_private_shm_page_t) + sizeof(fancy_memory_private_shm_slot_t) * slot_count;
+    // The object must not exist yet (another process may be publishing under the same
+    // name), such that it is created zero-filled, and only ever unlinked by its creator.
+    int descriptor = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (descriptor == -1)
+    {
+        return false;
+    }
+    fancy_memory_private_shm_page_t *page = MAP_FAILED;
+    if (ftruncate(descriptor, (off_t)size) == 0)
+    {
+        page = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    }
+    // The cleanup calls must not overwrite the error of the call that failed.
+    int error = errno;
+    close(descriptor);
+    if (page == MAP_FAILED)
+    {
+        shm_unlink(name);
+        errno = error;
+        return false;
+    }
+    char *copy = malloc(strlen(name) + 1);
+    if (copy == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+    }
+    strcpy(copy, name);
+    page->version = FANCY_MEMORY_SHM_VERSION;
+    page->pid = (uint64_t)getpid();
+    page->backend = (uint64_t)self->backend;
+    page->slot_count = slot_count;
+    page->bucket_count = FANCY_MEMORY_HISTOGRAM_BUCKETS;
+    self->shm = (fancy_memory_private_shm_t){.page = page, .size = size, .name = copy};
+    if (self->shards == NULL)
+    {
+        self->shm_slot = &page->slots[0];
+        fancy_memory_private_member_shm_refresh(self);
+    }
+    else
+    {
+        for (size_t i = 0; i < slot_count; i++)
+        {
+            fancy_memory_private_lock(&self->shards->items[i].lock);
+            self->shards->items[i].tracker->shm_slot = &page->slots[i];
+            fancy_memory_private_member_shm_refresh(self->shards->items[i].tracker);
+            fancy_memory_private_unlock(&self->shards->items[i].lock);
+        }
+    }
+    // The magic is written last, such that readers never accept a partial header.
+    atomic_thread_fence(memory_order_release);
+    memcpy(page->magic, FANCY_MEMORY_SHM_MAGIC, sizeof(page->magic));
+    return true;
+}
+
+void fancy_memory_unpublish(fancy_memory_t *self)
+{
+    if (self->shm.page == NULL)
+    {
+        return;
+    }
+    if (self->shards == NULL)
+    {
+        self->shm_slot = NULL;
+    }
+    else
+    {
+        for (size_t i = 0; i < self->shards->count; i++)
+        {
+            fancy_memory_private_lock(&self->shards->items[i].lock);
+            self->shards->items[i].tracker->shm_slot = NULL;
+            fancy_memory_private_unlock(&self->shards->items[i].lock);
+        }
+    }
+    munmap(self->shm.page, self->shm.size);
+    shm_unlink(self->shm.name);
+    free(self->shm.name);
+    self->shm = (fancy_memory_private_shm_t){0};
+}
+
+fancy_memory_handle_t fancy_memory_handle_alloc(fancy_memory_t *self, size_t size)
+{
+    if (self->shards != NULL)
+    {
+        FAIL_AND_TERMINATE("Concurrent objects cannot allocate handles.");
+    }
+    size_t index = fancy_memory_private_member_record_take(self);
+    size_t length = sizeof(fancy_memory_private_block_t) + fancy_memory_private_align(size == 0 ? 1 : size, FANCY_MEMORY_HANDLE_ALIGNMENT);
+    fancy_memory_private_record_t *record = &self->handles.records[index];
+    record->block = fancy_memory_private_member_region_carve(self, length, self->handles.source, &record->region);
+    record->block->record = index + 1;
+    record->block->length = length;
+    record->size = size;
+    record->birth = fancy_memory_private_member_clock(self);
+    record->pins = 0;
+    self->handles.count += 1;
+    fancy_memory_private_member_account_alloc(self, size, NULL);
+    return ((uint64_t)record->generation << 32) | (index + 1);
+}
+
+void fancy_memory_handle_free(fancy_memory_t *self, fancy_memory_handle_t handle)
+{
+    fancy_memory_private_record_t *record = fancy_memory_private_member_record_of(self, handle);
+    if (record->pins > 0)
+    {
+        FAIL_AND_TERMINATE("Trying to free a handle that is pinned.");
+    }
+    fancy_memory_private_handles_t *handles = &self->handles;
+    fancy_memory_private_region_t *region = &handles->regions[record->region];
+    region->live_length -= record->block->length;
+    region->live_count -= 1;
+    record->block->record = 0;
+    if (region->live_count == 0)
+    {
+        fancy_memory_private_member_region_release(self, record->region);
+    }
+    fancy_memory_private_member_account_free(self, record->size, NULL, record->birth);
+    record->block = NULL;
+    record->generation += 1;
+    record->next_free = handles->free_list;
+    handles->free_list = (size_t)(record - handles->records) + 1;
+    handles->count -= 1;
+}
+
+void *fancy_memory_pin(fancy_memory_t *self, fancy_memory_handle_t handle)
+{
+    fancy_memory_private_record_t *record = fancy_memory_private_member_record_of(self, handle);
+    record->pins += 1;
+    return record->block + 1;
+}
+
+void fancy_memory_unpin(fancy_memory_t *self, fancy_memory_handle_t handle)
+{
+    fancy_memory_private_record_t *record = fancy_memory_private_member_record_of(self, handle);
+    if (record->pins == 0)
+    {
+        FAIL_AND_TERMINATE("Trying to unpin a handle that is not pinned.");
+    }
+    record->pins -= 1;
+}
+
+bool fancy_memory_compact(fancy_memory_t *self, uint64_t budget)
+{
+    fancy_memory_private_handles_t *handles = &self->handles;
+    uint64_t deadline = fancy_memory_private_now() + budget;
+    size_t steps = 0;
+    for (;;)
+    {
+        if (handles->source == SIZE_MAX)
+        {
+            // The sparsest region that was not visited during the current pass.
+            size_t source = SIZE_MAX;
+            for (size_t i = 0; i < handles->region_count; i++)
+            {
+                fancy_memory_private_region_t const *region = &handles->regions[i];
+                if (i == handles->active || region->live_count == 0 || region->pass == handles->pass ||
+                    region->live_length * 2 >= region->cursor)
+                {
+                    continue;
+                }
+                if (source == SIZE_MAX || region->live_length < handles->regions[source].live_length)
+                {
+                    source = i;
+                }
+            }
+            if (source == SIZE_MAX)
+            {
+                handles->pass += 1;
+                return true;
+            }
+            handles->source = source;
+            handles->offset = 0;
+        }
+        while (handles->offset < handles->regions[handles->source].cursor)
+        {
+            if (++steps % FANCY_MEMORY_COMPACTION_CLOCK_INTERVAL == 0 && fancy_memory_private_now() >= deadline)
+            {
+                return false;
+            }
+            fancy_memory_private_block_t *block =
+                (fancy_memory_private_block_t *)(handles->regions[handles->source].base + handles->offset);
+            handles->offset += block->length;
+            if (block->record == 0 || handles->records[block->record - 1].pins > 0)
+            {
+                continue;
+            }
+            // Carving may add a region (i.e., move the regions array), so the source is
+            // looked up again afterwards.
+            fancy_memory_private_record_t *record = &handles->records[block->record - 1];
+            size_t target;
+            fancy_memory_private_block_t *moved = fancy_memory_private_member_region_carve(self, block->length, handles->source, &target);
+            memcpy(moved, block, block->length);
+            block->record = 0;
+            fancy_memory_private_region_t *source = &handles->regions[handles->source];
+            source->live_length -= moved->length;
+            source->live_count -= 1;
+            record->block = moved;
+            record->region = target;
+        }
+        handles->regions[handles->source].pass = handles->pass;
+        if (handles->regions[handles->source].live_count == 0)
+        {
+            fancy_memory_private_member_region_release(self, handles->source);
+        }
+        handles->source = SIZE_MAX;
+        if (fancy_memory_private_now() >= deadline)
+        {
+            return false;
+        }
+    }
+}
+
+void fancy_memory_reset(fancy_memory_t *self)
+{
+    fancy_memory_private_member_drain(self);
+    fancy_memory_private_member_retired_clear(self);
+    if (self->shards != NULL)
+    {
+        for (size_t i = 0; i < self->shards->count; i++)
+        {
+            fancy_memory_private_lock(&self->shards->items[i].lock);
+            fancy_memory_reset(self->shards->items[i].tracker);
+            fancy_memory_private_unlock(&self->shards->items[i].lock);
+        }
+        return;
+    }
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA)
+    {
+        fancy_memory_private_member_arena_reset(self);
+    }
+    else if (self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        fancy_memory_private_member_header_reset(self);
+    }
+    else
+    {
+        for (size_t i = 0; i < self->n; i++)
+        {
+            fancy_memory_private_member_release(self, self->entries[i].pointer, self->entries[i].size, self->entries[i].kind);
+        }
+        self->n = 0;
+        fancy_memory_private_table_release(&self->previous_index);
+        self->migration_position = 0;
+        if (self->index.count > 0)
+        {
+            memset(self->index.slots, 0, sizeof(fancy_memory_private_slot_t) * self->index.capacity);
+            self->index.count = 0;
+        }
+    }
+    fancy_memory_private_member_handles_reset(self);
+    fancy_memory_private_member_roll_up(
+        self, (size_t)0 - self->stats.live_bytes, (size_t)0 - self->stats.live_count, 0, self->stats.live_count, 0);
+    self->stats.free_count += self->stats.live_count;
+    self->stats.live_bytes = 0;
+    self->stats.live_count = 0;
+    for (size_t i = 0; i < self->sites.capacity; i++)
+    {
+        if (self->sites.slots[i] != NULL)
+        {
+            self->sites.slots[i]->live_bytes = 0;
+            self->sites.slots[i]->live_count = 0;
+        }
+    }
+    if (self->shm_slot != NULL)
+    {
+        fancy_memory_private_member_shm_refresh(self);
+    }
+}
+
+void fancy_memory_reset_tree(fancy_memory_t *self)
+{
+    for (fancy_memory_t *child = self->children; child != NULL; child = child->next_sibling)
+    {
+        fancy_memory_reset_tree(child);
+    }
+    fancy_memory_reset(self);
+}
+
+void fancy_memory_reserve(fancy_memory_t *self, size_t n)
+{
+    if (self->shards != NULL)
+    {
+        for (size_t i = 0; i < self->shards->count; i++)
+        {
+            fancy_memory_private_lock(&self->shards->items[i].lock);
+            fancy_memory_reserve(self->shards->items[i].tracker, n / self->shards->count + 1);
+            fancy_memory_private_unlock(&self->shards->items[i].lock);
+        }
+        return;
+    }
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        return;
+    }
+    self->reserved = n;
+    if (n > self->capacity)
+    {
+        fancy_memory_private_member_set_capacity(self, n);
+    }
+    size_t index_capacity = FANCY_MEMORY_INDEX_MIN_CAPACITY;
+    while (index_capacity < n * 2)
+    {
+        index_capacity *= 2;
+    }
+    if (index_capacity > self->index.capacity)
+    {
+        // Reserving is a bulk operation, which may as well finish a pending migration.
+        fancy_memory_private_member_index_migrate(self, SIZE_MAX);
+        fancy_memory_private_member_index_resize(self, index_capacity);
+    }
+}
+
+size_t fancy_memory_get_total(fancy_memory_t const *self)
+{
+    if (self->shards != NULL)
+    {
+        fancy_memory_stats_t stats;
+        fancy_memory_private_member_concurrent_stats(self, &stats);
+        return stats.live_bytes;
+    }
+    return self->stats.live_bytes + self->descendants.live_bytes - self->stats.retired_bytes - self->descendants.retired_bytes;
+}
+
+void fancy_memory_get_stats(fancy_memory_t const *self, fancy_memory_stats_t *stats)
+{
+    if (self->shards != NULL)
+    {
+        fancy_memory_private_member_concurrent_stats(self, stats);
+        return;
+    }
+    *stats = self->stats;
+    if (self->children != NULL || self->descendants.allocation_count > 0)
+    {
+        stats->live_bytes += self->descendants.live_bytes;
+        stats->live_count += self->descendants.live_count;
+        stats->allocation_count += self->descendants.allocation_count;
+        stats->free_count += self->descendants.free_count;
+        stats->reallocation_count += self->descendants.reallocation_count;
+        // The subtree's peaks are never lower than those of the tracker's own blocks.
+        stats->peak_bytes = self->descendants.peak_bytes > stats->peak_bytes ? self->descendants.peak_bytes : stats->peak_bytes;
+        stats->peak_count = self->descendants.peak_count > stats->peak_count ? self->descendants.peak_count : stats->peak_count;
+        stats->retired_bytes += self->descendants.retired_bytes;
+        stats->retired_count += self->descendants.retired_count;
+    }
+    stats->live_bytes -= stats->retired_bytes;
+    stats->live_count -= stats->retired_count;
+}
+
+void fancy_memory_get_histograms(fancy_memory_t const *self, fancy_memory_histograms_t *histograms)
+{
+    if (self->shards == NULL)
+    {
+        *histograms = self->histograms;
+        return;
+    }
+    *histograms = (fancy_memory_histograms_t){0};
+    for (size_t i = 0; i < self->shards->count; i++)
+    {
+        fancy_memory_private_lock(&self->shards->items[i].lock);
+        fancy_memory_histograms_t const *shard_histograms = &self->shards->items[i].tracker->histograms;
+        for (size_t j = 0; j < FANCY_MEMORY_HISTOGRAM_BUCKETS; j++)
+        {
+            histograms->sizes[j] += shard_histograms->sizes[j];
+            histograms->lifetimes[j] += shard_histograms->lifetimes[j];
+        }
+        fancy_memory_private_unlock(&self->shards->items[i].lock);
+    }
+}
+
+size_t fancy_memory_get_top_sites(fancy_memory_t const *self, fancy_memory_site_stats_t *sites, size_t n)
+{
+    size_t count = fancy_memory_private_member_collect_sites(self, NULL, 0);
+    if (count == 0 || n == 0)
+    {
+        return 0;
+    }
+    fancy_memory_site_stats_t *all = malloc(sizeof(fancy_memory_site_stats_t) * count);
+    if (all == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+    }
+    count = fancy_memory_private_member_collect_sites(self, all, count);
+    // Records for the same location may exist more than once (e.g., once per shard,
+    // or when a string literal is not merged), so they are merged first.
+    qsort(all, count, sizeof(fancy_memory_site_stats_t), fancy_memory_private_compare_site_locations);
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (merged > 0 && fancy_memory_private_compare_site_locations(&all[merged - 1], &all[i]) == 0)
+        {
+            all[merged - 1].live_bytes += all[i].live_bytes;
+            all[merged - 1].live_count += all[i].live_count;
+            all[merged - 1].allocation_count += all[i].allocation_count;
+            all[merged - 1].allocated_bytes += all[i].allocated_bytes;
+        }
+        else
+        {
+            all[merged++] = all[i];
+        }
+    }
+    qsort(all, merged, sizeof(fancy_memory_site_stats_t), fancy_memory_private_compare_site_live_bytes);
+    if (n > merged)
+    {
+        n = merged;
+    }
+    memcpy(sites, all, sizeof(fancy_memory_site_stats_t) * n);
+    free(all);
+    return n;
+}
+
+bool fancy_memory_snapshot_write(fancy_memory_t const *self, FILE *stream)
+{
+    fancy_memory_private_writer_t writer = {stream, malloc(FANCY_MEMORY_SNAPSHOT_BUFFER_SIZE), 0, false};
+    if (writer.buffer == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+    }
+    fancy_memory_private_writer_bytes(&writer, FANCY_MEMORY_SNAPSHOT_MAGIC, 8);
+    fancy_memory_private_writer_u64(&writer, FANCY_MEMORY_SNAPSHOT_VERSION);
+    fancy_memory_private_writer_u64(&writer, (uint64_t)self->backend);
+    fancy_memory_private_writer_u64(&writer, self->shards == NULL ? 0 : self->shards->count);
+
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(self, &stats);
+    fancy_memory_private_writer_u64(&writer, stats.live_bytes);
+    fancy_memory_private_writer_u64(&writer, stats.live_count);
+    fancy_memory_private_writer_u64(&writer, stats.peak_bytes);
+    fancy_memory_private_writer_u64(&writer, stats.peak_count);
+    fancy_memory_private_writer_u64(&writer, stats.allocation_count);
+    fancy_memory_private_writer_u64(&writer, stats.free_count);
+    fancy_memory_private_writer_u64(&writer, stats.reallocation_count);
+
+    fancy_memory_histograms_t histograms;
+    fancy_memory_get_histograms(self, &histograms);
+    fancy_memory_private_writer_u64(&writer, FANCY_MEMORY_HISTOGRAM_BUCKETS);
+    for (size_t i = 0; i < FANCY_MEMORY_HISTOGRAM_BUCKETS; i++)
+    {
+        fancy_memory_private_writer_u64(&writer, histograms.sizes[i]);
+    }
+    for (size_t i = 0; i < FANCY_MEMORY_HISTOGRAM_BUCKETS; i++)
+    {
+        fancy_memory_private_writer_u64(&writer, histograms.lifetimes[i]);
+    }
+
+    size_t site_count = fancy_memory_private_member_collect_sites(self, NULL, 0);
+    fancy_memory_site_stats_t *sites = NULL;
+    if (site_count > 0)
+    {
+        sites = malloc(sizeof(fancy_memory_site_stats_t) * site_count);
+        if (sites == NULL)
+        {
+            FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+        }
+        site_count = fancy_memory_get_top_sites(self, sites, site_count);
+    }
+    fancy_memory_private_writer_u64(&writer, site_count);
+    for (size_t i = 0; i < site_count; i++)
+    {
+        fancy_memory_private_writer_string(&writer, sites[i].file);
+        fancy_memory_private_writer_u64(&writer, (uint64_t)(int64_t)sites[i].line);
+        fancy_memory_private_writer_string(&writer, sites[i].function);
+        fancy_memory_private_writer_u64(&writer, sites[i].live_bytes);
+        fancy_memory_private_writer_u64(&writer, sites[i].live_count);
+        fancy_memory_private_writer_u64(&writer, sites[i].allocation_count);
+        fancy_memory_private_writer_u64(&writer, sites[i].allocated_bytes);
+    }
+    free(sites);
+
+    if (self->shards != NULL)
+    {
+        for (size_t i = 0; i < self->shards->count; i++)
+        {
+            fancy_memory_private_lock(&self->shards->items[i].lock);
+            fancy_memory_private_member_snapshot_entries(self->shards->items[i].tracker, &writer);
+            fancy_memory_private_unlock(&self->shards->items[i].lock);
+        }
+    }
+    else
+    {
+        fancy_memory_private_member_snapshot_entries(self, &writer);
+    }
+    fancy_memory_private_writer_u64(&writer, 0);
+    fancy_memory_private_writer_flush(&writer);
+    free(writer.buffer);
+    return !writer.failed && fflush(stream) == 0;
+}
+
+static size_t fancy_memory_private_member_next_index(fancy_memory_t *self)
+{
+    if (self->n == self->capacity)
+    {
+        size_t capacity = self->capacity * 2;
+        fancy_memory_private_member_set_capacity(
+            self, capacity < FANCY_MEMORY_ENTRIES_MIN_CAPACITY ? FANCY_MEMORY_ENTRIES_MIN_CAPACITY : capacity);
+    }
+    size_t index = self->n;
+    self->n += 1;
+    return index;
+}
+
+static void fancy_memory_private_member_set_capacity(fancy_memory_t *self, size_t capacity)
+{
+    if (capacity == 0)
+    {
+        free(self->entries);
+        self->entries = NULL;
+        self->capacity = 0;
+        return;
+    }
+    fancy_memory_private_entry_t *entries = realloc(self->entries, sizeof(fancy_memory_private_entry_t) * capacity);
+    if (entries == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+    }
+    self->entries = entries;
+    self->capacity = capacity;
+}
+
+static void *fancy_memory_private_member_malloc(
+    fancy_memory_t *self, size_t size, size_t alignment, bool zeroed, fancy_memory_private_location_t const *location)
+{
+    fancy_memory_private_member_drain(self);
+    if (self->shards != NULL)
+    {
+        return fancy_memory_private_member_concurrent_malloc(self, size, alignment, zeroed, location);
+    }
+    fancy_memory_site_stats_t *site = fancy_memory_private_member_site_of(self, location);
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA)
+    {
+        fancy_memory_private_header_t *header = fancy_memory_private_member_arena_carve(self, size, alignment, site);
+        if (zeroed)
+        {
+            memset(header + 1, 0, size);
+        }
+        fancy_memory_private_member_account_alloc(self, size, site);
+        return header + 1;
+    }
+    if (self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        if (alignment > FANCY_MEMORY_DEFAULT_ALIGNMENT)
+        {
+            FAIL_AND_TERMINATE("Alignments of more than 16 bytes are not supported by the header backend.");
+        }
+        return fancy_memory_private_member_header_malloc(self, size, zeroed, site);
+    }
+    unsigned int kind = FANCY_MEMORY_KIND_GUARDED;
+    void *pointer = fancy_memory_private_member_sampled(self, alignment)
+                        ? fancy_memory_private_guarded_acquire(size, alignment)
+                        : fancy_memory_private_member_acquire(self, size, alignment, zeroed, &kind);
+    fancy_memory_private_member_track(self, pointer, size, kind, site);
+    fancy_memory_private_member_account_alloc(self, size, site);
+    return pointer;
+}
+
+static bool fancy_memory_private_member_free(fancy_memory_t *self, void *pointer, bool retired)
+{
+    // Returns `false` (without doing anything) if `pointer` is not tracked by `self`,
+    // which the public methods turn into a failure (except for the "try" variants).
+    // Retired blocks may only be freed by reclamation (i.e., when `retired` is `true`).
+    if (self->shards != NULL)
+    {
+        return fancy_memory_private_member_concurrent_free(self, pointer, retired);
+    }
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        if (!fancy_memory_private_member_owns_header(self, pointer))
+        {
+            return false;
+        }
+        if ((((fancy_memory_private_header_t *)pointer - 1)->tag & FANCY_MEMORY_HEADER_RETIRED) != 0 && !retired)
+        {
+            FAIL_AND_TERMINATE("Trying to free memory for address that has been retired.");
+        }
+        if (self->backend == FANCY_MEMORY_BACKEND_ARENA)
+        {
+            fancy_memory_private_member_arena_free(
+                self, pointer, "Trying to free memory for address that is not being tracked by the specified instance.");
+        }
+        else
+        {
+            fancy_memory_private_member_header_free(self, pointer);
+        }
+        return true;
+    }
+    ssize_t index = fancy_memory_private_member_index_of(self, pointer);
+    if (index == -1)
+    {
+        return false;
+    }
+    if (self->entries[index].retired && !retired)
+    {
+        FAIL_AND_TERMINATE("Trying to free memory for address that has been retired.");
+    }
+    size_t size = self->entries[index].size;
+    unsigned int kind = self->entries[index].kind;
+    fancy_memory_private_member_account_free(self, size, self->entries[index].site, self->entries[index].birth);
+    fancy_memory_private_member_untrack(self, (size_t)index);
+    fancy_memory_private_member_release(self, pointer, size, kind);
+    return true;
+}
+
+static void fancy_memory_private_member_free_many(fancy_memory_t *self, void *const *pointers, size_t n, bool retired)
+{
+    // Only reclamation (i.e., when `retired` is `true`) may free retired blocks.
+    if (self->shards != NULL || self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (!fancy_memory_private_member_free(self, pointers[i], retired))
+            {
+                FAIL_AND_TERMINATE("Trying to free memory for address that is not being tracked by the specified instance.");
+            }
+        }
+        return;
+    }
+    size_t bytes = 0;
+    uint64_t clock = fancy_memory_private_member_clock(self);
+    fancy_memory_private_shm_slot_t *slot = self->shm_slot;
+    if (slot != NULL)
+    {
+        fancy_memory_private_shm_begin(slot);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        ssize_t index = fancy_memory_private_member_index_of(self, pointers[i]);
+        if (index == -1)
+        {
+            FAIL_AND_TERMINATE("Trying to free memory for address that is not being tracked by the specified instance.");
+        }
+        fancy_memory_private_entry_t entry = self->entries[index];
+        if (entry.retired && !retired)
+        {
+            FAIL_AND_TERMINATE("Trying to free memory for address that has been retired.");
+        }
+        if (entry.site != NULL)
+        {
+            entry.site->live_bytes -= entry.size;
+            entry.site->live_count -= 1;
+        }
+        self->histograms.lifetimes[fancy_memory_private_bucket_of(clock - entry.birth)] += 1;
+        fancy_memory_private_member_untrack(self, (size_t)index);
+        fancy_memory_private_member_release(self, entry.pointer, entry.size, entry.kind);
+        bytes += entry.size;
+        if (slot != NULL)
+        {
+            fancy_memory_private_shm_count(slot, entry.size, (uint64_t)0 - 1);
+        }
+    }
+    self->stats.live_bytes -= bytes;
+    self->stats.live_count -= n;
+    self->stats.free_count += n;
+    if (slot != NULL)
+    {
+        fancy_memory_private_shm_end(slot, &self->stats);
+    }
+    fancy_memory_private_member_roll_up(self, (size_t)0 - bytes, (size_t)0 - n, 0, n, 0);
+}
+
+static void *fancy_memory_private_member_realloc(fancy_memory_t *self, void *pointer, size_t size, fancy_memory_private_location_t const *location)
+{
+    // Returns the NULL pointer if `pointer` is not tracked by `self` (reallocations
+    // never do otherwise, since they terminate the process when they fail).
+    if (self->shards != NULL)
+    {
+        return fancy_memory_private_member_concurrent_realloc(self, pointer, size, location);
+    }
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        if (!fancy_memory_private_member_owns_header(self, pointer))
+        {
+            return NULL;
+        }
+        if ((((fancy_memory_private_header_t *)pointer - 1)->tag & FANCY_MEMORY_HEADER_RETIRED) != 0)
+        {
+            FAIL_AND_TERMINATE("Trying to reallocate memory for address that has been retired.");
+        }
+    }
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA)
+    {
+        return fancy_memory_private_member_arena_realloc(self, pointer, size, location);
+    }
+    if (self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        return fancy_memory_private_member_header_realloc(self, pointer, size, location);
+    }
+    ssize_t index = fancy_memory_private_member_index_of(self, pointer);
+    if (index == -1)
+    {
+        return NULL;
+    }
+    if (self->entries[index].retired)
+    {
+        FAIL_AND_TERMINATE("Trying to reallocate memory for address that has been retired.");
+    }
+    // The old address must leave the index before `realloc` invalidates it.
+    fancy_memory_private_member_index_erase(self, pointer);
+    void *new_pointer = fancy_memory_private_member_resize(self, pointer, self->entries[index].size, size, &self->entries[index].kind);
+    fancy_memory_private_member_index_insert(self, new_pointer, (size_t)index);
+    fancy_memory_site_stats_t *site = location == NULL ? self->entries[index].site : fancy_memory_private_member_site_of(self, location);
+    fancy_memory_private_member_account_realloc(self, self->entries[index].size, size, self->entries[index].site, site);
+    self->entries[index].pointer = new_pointer;
+    self->entries[index].size = size;
+    self->entries[index].site = site;
+    return new_pointer;
+}
+
+static void *fancy_memory_private_member_acquire(fancy_memory_t *self, size_t size, size_t alignment, bool zeroed, unsigned int *kind)
+{
+    if (self->backend == FANCY_MEMORY_BACKEND_POOL && size <= FANCY_MEMORY_POOL_MAX_SIZE &&
+        alignment <= FANCY_MEMORY_POOL_ALIGNMENT)
+    {
+        void *pointer = fancy_memory_private_member_pool_acquire(self, fancy_memory_private_pool_class_of(size));
+        if (zeroed)
+        {
+            memset(pointer, 0, size);
+        }
+        *kind = FANCY_MEMORY_KIND_DEFAULT;
+        return pointer;
+    }
+    return fancy_memory_private_system_acquire(size, alignment, zeroed, self->large_threshold, kind);
+}
+
+static void fancy_memory_private_member_release(fancy_memory_t *self, void *pointer, size_t size, unsigned int kind)
+{
+    // For the default kind, the tracked (i.e., requested) size alone tells which
+    // allocator owns a block.
+    if (kind == FANCY_MEMORY_KIND_GUARDED)
+    {
+        fancy_memory_private_member_quarantine(self, pointer, size);
+        return;
+    }
+    if (kind == FANCY_MEMORY_KIND_DEFAULT && self->backend == FANCY_MEMORY_BACKEND_POOL && size <= FANCY_MEMORY_POOL_MAX_SIZE)
+    {
+        size_t class_index = fancy_memory_private_pool_class_of(size);
+        *(void **)pointer = self->pool.free_lists[class_index];
+        self->pool.free_lists[class_index] = pointer;
+        return;
+    }
+    fancy_memory_private_system_release(pointer, size, kind);
+}
+
+static void *fancy_memory_private_member_resize(fancy_memory_t *self, void *pointer, size_t old_size, size_t new_size, unsigned int *kind)
+{
+    // Default blocks of up to 256 bytes are owned by the pool, which is also where
+    // blocks (of any kind, except guarded ones) shrinking to that size move to.
+    if (*kind == FANCY_MEMORY_KIND_GUARDED)
+    {
+        return fancy_memory_private_member_guarded_resize(self, pointer, old_size, new_size);
+    }
+    bool pooled = *kind == FANCY_MEMORY_KIND_DEFAULT && old_size <= FANCY_MEMORY_POOL_MAX_SIZE;
+    if (self->backend == FANCY_MEMORY_BACKEND_POOL && (pooled || new_size <= FANCY_MEMORY_POOL_MAX_SIZE))
+    {
+        if (pooled && new_size <= FANCY_MEMORY_POOL_MAX_SIZE &&
+            fancy_memory_private_pool_class_of(old_size) == fancy_memory_private_pool_class_of(new_size))
+        {
+            return pointer;
+        }
+        unsigned int new_kind;
+        void *new_pointer = fancy_memory_private_member_acquire(self, new_size, FANCY_MEMORY_DEFAULT_ALIGNMENT, false, &new_kind);
+        memcpy(new_pointer, pointer, old_size < new_size ? old_size : new_size);
+        fancy_memory_private_member_release(self, pointer, old_size, *kind);
+        *kind = new_kind;
+        return new_pointer;
+    }
+    return fancy_memory_private_system_resize(pointer, old_size, new_size, self->large_threshold, kind);
+}
+
+static void *fancy_memory_private_system_acquire(size_t size, size_t alignment, bool zeroed, size_t threshold, unsigned int *kind)
+{
+    // These helpers do not touch any tracker state, so that concurrent trackers can
+    // call them outside of their shard locks.
+    if (threshold != 0 && size >= threshold)
+    {
+        // Fresh anonymous mappings are zero-filled, so `zeroed` comes for free.
+        *kind = FANCY_MEMORY_KIND_MAPPED;
+        return fancy_memory_private_map(size, alignment);
+    }
+    void *pointer;
+    if (alignment > FANCY_MEMORY_DEFAULT_ALIGNMENT)
+    {
+        *kind = FANCY_MEMORY_KIND_SYSTEM;
+        if (posix_memalign(&pointer, alignment, size) != 0)
+        {
+            FAIL_AND_TERMINATE("Call to 'posix_memalign' failed.");
+        }
+        if (zeroed)
+        {
+            memset(pointer, 0, size);
+        }
+        return pointer;
+    }
+    *kind = FANCY_MEMORY_KIND_DEFAULT;
+    if (zeroed)
+    {
+        pointer = calloc(1, size);
+        if (pointer == NULL)
+        {
+            FAIL_AND_TERMINATE("Call to 'calloc' returned the NULL pointer.");
+        }
+        return pointer;
+    }
+    pointer = malloc(size);
+    if (pointer == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+    }
+    return pointer;
+}
+
+static void fancy_memory_private_system_release(void *pointer, size_t size, unsigned int kind)
+{
+    if (kind == FANCY_MEMORY_KIND_MAPPED)
+    {
+        if (munmap(pointer, fancy_memory_private_mapped_length(size)) != 0)
+        {
+            FAIL_AND_TERMINATE("Call to 'munmap' failed.");
+        }
+        return;
+    }
+    free(pointer);
+}
+
+static void *fancy_memory_private_system_resize(void *pointer, size_t old_size, size_t new_size, size_t threshold, unsigned int *kind)
+{
+    // Blocks move between the heap and mappings when they cross the threshold (in
+    // either direction), while over-aligned (i.e., "system") blocks, like with
+    // `realloc`, do not keep their alignment.
+    bool mapped = threshold != 0 && new_size >= threshold && *kind != FANCY_MEMORY_KIND_SYSTEM;
+    if (*kind == FANCY_MEMORY_KIND_MAPPED && mapped)
+    {
+        size_t old_length = fancy_memory_private_mapped_length(old_size);
+        size_t new_length = fancy_memory_private_mapped_length(new_size);
+        if (new_length == old_length)
+        {
+            return pointer;
+        }
+#ifdef MREMAP_MAYMOVE
+        // The pages are moved (or the mapping is extended in place) by updating page
+        // tables, so the content is never copied. Systems without `mremap` (which is
+        // specific to Linux) copy the block into a new mapping instead, below.
+        void *new_pointer = mremap(pointer, old_length, new_length, MREMAP_MAYMOVE);
+        if (new_pointer == MAP_FAILED)
+        {
+            FAIL_AND_TERMINATE("Call to 'mremap' failed.");
+        }
+#ifdef MADV_HUGEPAGE
+        if (new_length >= FANCY_MEMORY_HUGE_PAGE_SIZE)
+        {
+            (void)madvise(new_pointer, new_length, MADV_HUGEPAGE);
+        }
+#endif
+        return new_pointer;
+#endif
+    }
+    if (*kind == FANCY_MEMORY_KIND_MAPPED || mapped)
+    {
+        unsigned int new_kind;
+        void *new_pointer = fancy_memory_private_system_acquire(new_size, FANCY_MEMORY_DEFAULT_ALIGNMENT, false, threshold, &new_kind);
+        memcpy(new_pointer, pointer, old_size < new_size ? old_size : new_size);
+        fancy_memory_private_system_release(pointer, old_size, *kind);
+        *kind = new_kind;
+        return new_pointer;
+    }
+    void *new_pointer = realloc(pointer, new_size);
+    if (new_pointer == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+    }
+    return new_pointer;
+}
+
+static void *fancy_memory_private_map(size_t size, size_t alignment)
+{
+    size_t length = fancy_memory_private_mapped_length(size);
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (length >= FANCY_MEMORY_HUGE_PAGE_SIZE && alignment < FANCY_MEMORY_HUGE_PAGE_SIZE)
+    {
+        alignment = FANCY_MEMORY_HUGE_PAGE_SIZE;
+    }
+    // Larger alignments are obtained by over-mapping, and unmapping the excess on
+    // both sides of the aligned range.
+    size_t extra = alignment > page_size ? alignment : 0;
+    char *mapping = mmap(NULL, length + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        FAIL_AND_TERMINATE("Call to 'mmap' failed.");
+    }
+    char *pointer = mapping;
+    if (extra > 0)
+    {
+        pointer = (char *)fancy_memory_private_align((uintptr_t)mapping, alignment);
+        if ((pointer > mapping && munmap(mapping, (size_t)(pointer - mapping)) != 0) ||
+            (mapping + extra > pointer && munmap(pointer + length, (size_t)(mapping + extra - pointer)) != 0))
+        {
+            FAIL_AND_TERMINATE("Call to 'munmap' failed.");
+        }
+    }
+#ifdef MADV_HUGEPAGE
+    if (length >= FANCY_MEMORY_HUGE_PAGE_SIZE)
+    {
+        // This is only a hint (e.g., it fails if transparent huge pages are disabled), and
+        // transparent huge pages are specific to Linux.
+        (void)madvise(pointer, length, MADV_HUGEPAGE);
+    }
+#endif
+    return pointer;
+}
+
+static bool fancy_memory_private_member_sampled(fancy_memory_t *self, size_t alignment)
+{
+    // Over-aligned blocks (i.e., beyond a page) are never sampled.
+    bool sampled;
+    if (self->shards == NULL)
+    {
+        sampled = --self->sample_countdown == 0;
+        if (sampled)
+        {
+            self->sample_countdown = self->sample_rate == 0 ? SIZE_MAX : self->sample_rate;
+        }
+    }
+    else
+    {
+        if (self->sample_rate == 0)
+        {
+            return false;
+        }
+        fancy_memory_private_sampler_t *sampler = &fancy_memory_private_sampler;
+        if (sampler->tracker != self || sampler->countdown > self->sample_rate)
+        {
+            // The thread's first call on `self` (or the rate was lowered).
+            uint64_t hash = (sampler->restarts++ + 1) * UINT64_C(0x9E3779B97F4A7C15);
+            sampler->tracker = self;
+            sampler->countdown = 1 + (size_t)((hash >> 32) % self->sample_rate);
+        }
+        sampled = --sampler->countdown == 0;
+        if (sampled)
+        {
+            sampler->countdown = self->sample_rate;
+        }
+    }
+    return sampled && alignment <= (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void *fancy_memory_private_guarded_acquire(size_t size, size_t alignment)
+{
+    // The block's (aligned) end is the guard page's start, so that accesses past its
+    // end fault (except within the alignment padding).
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = fancy_memory_private_align(size == 0 ? 1 : size, alignment);
+    size_t data_length = fancy_memory_private_align(length, page_size);
+    char *mapping = mmap(NULL, data_length + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        FAIL_AND_TERMINATE("Call to 'mmap' failed.");
+    }
+    if (mprotect(mapping + data_length, page_size, PROT_NONE) != 0)
+    {
+        FAIL_AND_TERMINATE("Call to 'mprotect' failed.");
+    }
+    return mapping + data_length - length;
+}
+
+static void fancy_memory_private_guarded_release(void *pointer, size_t size, bool quarantined)
+{
+    // Unmaps the block's mapping if it leaves the quarantine, or else makes it entirely
+    // inaccessible (before it enters the quarantine). The guard page is the first page
+    // boundary after the block's (first) byte.
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)pointer & ~(uintptr_t)(page_size - 1);
+    uintptr_t guard = fancy_memory_private_align((uintptr_t)pointer + (size == 0 ? 1 : size), page_size);
+    if (quarantined ? munmap((void *)start, guard - start + page_size) != 0
+                    : mprotect((void *)start, guard - start, PROT_NONE) != 0)
+    {
+        FAIL_AND_TERMINATE("Call to 'munmap' (or 'mprotect') failed.");
+    }
+}
+
+static void *fancy_memory_private_member_guarded_resize(fancy_memory_t *self, void *pointer, size_t old_size, size_t new_size)
+{
+    // Reallocated blocks stay guarded (and always move).
+    void *new_pointer = fancy_memory_private_guarded_acquire(new_size, FANCY_MEMORY_DEFAULT_ALIGNMENT);
+    memcpy(new_pointer, pointer, old_size < new_size ? old_size : new_size);
+    fancy_memory_private_member_quarantine(self, pointer, old_size);
+    return new_pointer;
+}
+
+static void fancy_memory_private_member_quarantine(fancy_memory_t *self, void *pointer, size_t size)
+{
+    // Concurrent trackers release blocks outside of their shard locks, so their
+    // (shared) quarantine is guarded by the statistics lock instead.
+    fancy_memory_private_guarded_release(pointer, size, false);
+    if (self->shards != NULL)
+    {
+        fancy_memory_private_lock(&self->shards->stats_lock);
+    }
+    fancy_memory_private_quarantine_t *quarantine = &self->quarantine;
+    if (quarantine->count == FANCY_MEMORY_QUARANTINE_SIZE)
+    {
+        fancy_memory_private_guarded_release(quarantine->pointers[quarantine->next], quarantine->sizes[quarantine->next], true);
+    }
+    else
+    {
+        quarantine->count += 1;
+    }
+    quarantine->pointers[quarantine->next] = pointer;
+    quarantine->sizes[quarantine->next] = size;
+    quarantine->next = (quarantine->next + 1) % FANCY_MEMORY_QUARANTINE_SIZE;
+    if (self->shards != NULL)
+    {
+        fancy_memory_private_unlock(&self->shards->stats_lock);
+    }
+}
+
+static size_t fancy_memory_private_mapped_length(size_t size)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    return fancy_memory_private_align(size == 0 ? 1 : size, page_size);
+}
+
+static void *fancy_memory_private_member_pool_acquire(fancy_memory_t *self, size_t class_index)
+{
+    fancy_memory_private_pool_t *pool = &self->pool;
+    void *pointer = pool->free_lists[class_index];
+    if (pointer != NULL)
+    {
+        pool->free_lists[class_index] = *(void **)pointer;
+        return pointer;
+    }
+    size_t block_size = fancy_memory_private_pool_class_sizes[class_index];
+    if (pool->cursors[class_index] == NULL || (size_t)(pool->limits[class_index] - pool->cursors[class_index]) < block_size)
+    {
+        fancy_memory_private_slab_t *slab = malloc(FANCY_MEMORY_POOL_SLAB_SIZE);
+        if (slab == NULL)
+        {
+            FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+        }
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->cursors[class_index] = (char *)slab + FANCY_MEMORY_POOL_ALIGNMENT;
+        pool->limits[class_index] = (char *)slab + FANCY_MEMORY_POOL_SLAB_SIZE;
+    }
+    pointer = pool->cursors[class_index];
+    pool->cursors[class_index] += block_size;
+    return pointer;
+}
+
+static size_t fancy_memory_private_pool_class_of(size_t size)
+{
+    if (size <= 128)
+    {
+        return size == 0 ? 0 : (size - 1) / 16;
+    }
+    return 8 + (size - 129) / 32;
+}
+
+static fancy_memory_private_header_t *fancy_memory_private_member_arena_carve(
+    fancy_memory_t *self, size_t size, size_t alignment, fancy_memory_site_stats_t *site)
+{
+    fancy_memory_private_arena_t *arena = &self->arena;
+    // Over-aligned blocks are preceded by padding (which is lost until the next reset).
+    size_t padding = fancy_memory_private_align((uintptr_t)arena->cursor + sizeof(fancy_memory_private_header_t), alignment) -
+                     ((uintptr_t)arena->cursor + sizeof(fancy_memory_private_header_t));
+    size_t needed = sizeof(fancy_memory_private_header_t) + fancy_memory_private_align(size, FANCY_MEMORY_ARENA_ALIGNMENT);
+    if ((size_t)(arena->limit - arena->cursor) < padding + needed)
+    {
+        size_t chunk_size = sizeof(fancy_memory_private_chunk_t) + needed + (alignment > FANCY_MEMORY_ARENA_ALIGNMENT ? alignment : 0);
+        fancy_memory_private_member_arena_add_chunk(self, chunk_size < arena->chunk_size ? arena->chunk_size : chunk_size);
+        padding = fancy_memory_private_align((uintptr_t)arena->cursor + sizeof(fancy_memory_private_header_t), alignment) -
+                  ((uintptr_t)arena->cursor + sizeof(fancy_memory_private_header_t));
+    }
+    fancy_memory_private_header_t *header = (fancy_memory_private_header_t *)(arena->cursor + padding);
+    arena->cursor += padding + needed;
+    arena->last = header;
+    header->size = size;
+    header->site = site;
+    header->birth = fancy_memory_private_member_clock(self);
+    fancy_memory_private_member_header_link(self, header);
+    return header;
+}
+
+static void fancy_memory_private_member_arena_free(fancy_memory_t *self, void *pointer, char const *message)
+{
+    fancy_memory_private_arena_t *arena = &self->arena;
+    fancy_memory_private_header_t *header = fancy_memory_private_member_header_of(self, pointer, message);
+    fancy_memory_private_member_header_unlink(self, header);
+    fancy_memory_private_member_account_free(self, header->size, header->site, header->birth);
+    if (header == arena->last)
+    {
+        // Only the most recent block can give its space back; the one before it is
+        // not known, so further frees will not roll the cursor back any further.
+        arena->cursor = (char *)header;
+        arena->last = NULL;
+    }
+}
+
+static void *fancy_memory_private_member_arena_realloc(fancy_memory_t *self, void *pointer, size_t size, fancy_memory_private_location_t const *location)
+{
+    fancy_memory_private_arena_t *arena = &self->arena;
+    fancy_memory_private_header_t *header = fancy_memory_private_member_header_of(
+        self, pointer, "Trying to reallocate memory for address that is not being tracked by the specified instance.");
+    fancy_memory_site_stats_t *site = location == NULL ? header->site : fancy_memory_private_member_site_of(self, location);
+    size_t needed = sizeof(fancy_memory_private_header_t) + fancy_memory_private_align(size, FANCY_MEMORY_ARENA_ALIGNMENT);
+    if (header == arena->last && (size_t)(arena->limit - (char *)header) >= needed)
+    {
+        arena->cursor = (char *)header + needed;
+        fancy_memory_private_member_account_realloc(self, header->size, size, header->site, site);
+        header->size = size;
+        header->site = site;
+        return pointer;
+    }
+    fancy_memory_private_header_t *new_header = fancy_memory_private_member_arena_carve(self, size, FANCY_MEMORY_DEFAULT_ALIGNMENT, site);
+    new_header->birth = header->birth;
+    memcpy(new_header + 1, pointer, header->size < size ? header->size : size);
+    fancy_memory_private_member_header_unlink(self, header);
+    fancy_memory_private_member_account_realloc(self, header->size, size, header->site, site);
+    return new_header + 1;
+}
+
+static void fancy_memory_private_member_arena_reset(fancy_memory_t *self)
+{
+    fancy_memory_private_arena_t *arena = &self->arena;
+    // Chunks are kept newest first, so the first chunk is the last one in the list.
+    while (arena->chunks->next != NULL)
+    {
+        fancy_memory_private_chunk_t *next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+    arena->cursor = (char *)(arena->chunks + 1);
+    arena->limit = (char *)arena->chunks + arena->chunks->size;
+    arena->last = NULL;
+    self->head = NULL;
+    self->tail = NULL;
+}
+
+static void *fancy_memory_private_member_header_malloc(fancy_memory_t *self, size_t size, bool zeroed, fancy_memory_site_stats_t *site)
+{
+    fancy_memory_private_header_t *header = zeroed ? calloc(1, sizeof(fancy_memory_private_header_t) + size)
+                                                   : malloc(sizeof(fancy_memory_private_header_t) + size);
+    if (header == NULL)
+    {
+        FAIL_AND_TERMINATE(zeroed ? "Call to 'calloc' returned the NULL pointer." : "Call to 'malloc' returned the NULL pointer.");
+    }
+    header->size = size;
+    header->site = site;
+    header->birth = fancy_memory_private_member_clock(self);
+    fancy_memory_private_member_header_link(self, header);
+    fancy_memory_private_member_account_alloc(self, size, site);
+    return header + 1;
+}
+
+static void fancy_memory_private_member_header_free(fancy_memory_t *self, void *pointer)
+{
+    fancy_memory_private_header_t *header = fancy_memory_private_member_header_of(
+        self, pointer, "Trying to free memory for address that is not being tracked by the specified instance.");
+    fancy_memory_private_member_header_unlink(self, header);
+    fancy_memory_private_member_account_free(self, header->size, header->site, header->birth);
+    free(header);
+}
+
+static void *fancy_memory_private_member_header_realloc(fancy_memory_t *self, void *pointer, size_t size, fancy_memory_private_location_t const *location)
+{
+    fancy_memory_private_header_t *header = fancy_memory_private_member_header_of(
+        self, pointer, "Trying to reallocate memory for address that is not being tracked by the specified instance.");
+    fancy_memory_site_stats_t *site = location == NULL ? header->site : fancy_memory_private_member_site_of(self, location);
+    size_t old_size = header->size;
+    header = realloc(header, sizeof(fancy_memory_private_header_t) + size);
+    if (header == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+    }
+    // The links were copied along with the header, so only the neighbours (which
+    // may still point to the old location) need to be updated.
+    if (header->previous != NULL)
+    {
+        header->previous->next = header;
+    }
+    else
+    {
+        self->head = header;
+    }
+    if (header->next != NULL)
+    {
+        header->next->previous = header;
+    }
+    else
+    {
+        self->tail = header;
+    }
+    fancy_memory_private_member_account_realloc(self, old_size, size, header->site, site);
+    header->size = size;
+    header->site = site;
+    return header + 1;
+}
+
+static void fancy_memory_private_member_header_reset(fancy_memory_t *self)
+{
+    fancy_memory_private_header_t *header = self->head;
+    while (header != NULL)
+    {
+        fancy_memory_private_header_t *next = header->next;
+        free(header);
+        header = next;
+    }
+    self->head = NULL;
+    self->tail = NULL;
+}
+
+static void fancy_memory_private_member_arena_add_chunk(fancy_memory_t *self, size_t size)
+{
+    fancy_memory_private_chunk_t *chunk = malloc(size);
+    if (chunk == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+    }
+    chunk->next = self->arena.chunks;
+    chunk->size = size;
+    self->arena.chunks = chunk;
+    self->arena.cursor = (char *)(chunk + 1);
+    self->arena.limit = (char *)chunk + size;
+    self->arena.last = NULL;
+}
+
+static fancy_memory_private_header_t *fancy_memory_private_member_header_of(fancy_memory_t *self, void *pointer, char const *message)
+{
+    if (!fancy_memory_private_member_owns_header(self, pointer))
+    {
+        FAIL_AND_TERMINATE(message);
+    }
+    return (fancy_memory_private_header_t *)pointer - 1;
+}
+
+static bool fancy_memory_private_member_owns_header(fancy_memory_t const *self, void const *pointer)
+{
+    return pointer != NULL && (((fancy_memory_private_header_t const *)pointer - 1)->tag & ~FANCY_MEMORY_HEADER_RETIRED) ==
+                                  ((uintptr_t)self ^ FANCY_MEMORY_HEADER_MAGIC);
+}
+
+static void fancy_memory_private_member_header_link(fancy_memory_t *self, fancy_memory_private_header_t *header)
+{
+    header->tag = (uintptr_t)self ^ FANCY_MEMORY_HEADER_MAGIC;
+    header->next = NULL;
+    header->previous = self->tail;
+    if (self->tail != NULL)
+    {
+        self->tail->next = header;
+    }
+    else
+    {
+        self->head = header;
+    }
+    self->tail = header;
+}
+
+static void fancy_memory_private_member_header_unlink(fancy_memory_t *self, fancy_memory_private_header_t *header)
+{
+    header->tag = 0;
+    if (header->previous != NULL)
+    {
+        header->previous->next = header->next;
+    }
+    else
+    {
+        self->head = header->next;
+    }
+    if (header->next != NULL)
+    {
+        header->next->previous = header->previous;
+    }
+    else
+    {
+        self->tail = header->previous;
+    }
+}
+
+static fancy_memory_private_record_t *fancy_memory_private_member_record_of(fancy_memory_t *self, fancy_memory_handle_t handle)
+{
+    size_t index = (size_t)(handle & UINT32_MAX);
+    if (index == 0 || index > self->handles.used || self->handles.records[index - 1].block == NULL ||
+        self->handles.records[index - 1].generation != (uint32_t)(handle >> 32))
+    {
+        FAIL_AND_TERMINATE("Trying to use a handle that is not being tracked by the specified instance.");
+    }
+    return &self->handles.records[index - 1];
+}
+
+static size_t fancy_memory_private_member_record_take(fancy_memory_t *self)
+{
+    fancy_memory_private_handles_t *handles = &self->handles;
+    if (handles->free_list != 0)
+    {
+        size_t index = handles->free_list - 1;
+        handles->free_list = handles->records[index].next_free;
+        return index;
+    }
+    if (handles->used == UINT32_MAX)
+    {
+        FAIL_AND_TERMINATE("Too many handles.");
+    }
+    if (handles->used == handles->capacity)
+    {
+        size_t capacity = handles->capacity == 0 ? FANCY_MEMORY_ENTRIES_MIN_CAPACITY : handles->capacity * 2;
+        fancy_memory_private_record_t *records = realloc(handles->records, sizeof(fancy_memory_private_record_t) * capacity);
+        if (records == NULL)
+        {
+            FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+        }
+        handles->records = records;
+        handles->capacity = capacity;
+    }
+    handles->records[handles->used] = (fancy_memory_private_record_t){.generation = 1};
+    return handles->used++;
+}
+
+static fancy_memory_private_block_t *fancy_memory_private_member_region_carve(fancy_memory_t *self, size_t length, size_t excluded, size_t *region)
+{
+    // Blocks are carved out of the current region, or else out of the first empty
+    // region large enough, or else out of a new region.
+    fancy_memory_private_handles_t *handles = &self->handles;
+    size_t index = handles->active;
+    if (index == SIZE_MAX || index == excluded || handles->regions[index].size - handles->regions[index].cursor < length)
+    {
+        index = SIZE_MAX;
+        for (size_t i = 0; i < handles->region_count; i++)
+        {
+            if (i != excluded && handles->regions[i].live_count == 0 && handles->regions[i].size >= length)
+            {
+                index = i;
+                handles->regions[i].cursor = 0;
+                break;
+            }
+        }
+    }
+    if (index == SIZE_MAX)
+    {
+        if (handles->region_count == handles->region_capacity)
+        {
+            size_t capacity = handles->region_capacity == 0 ? 4 : handles->region_capacity * 2;
+            fancy_memory_private_region_t *regions = realloc(handles->regions, sizeof(fancy_memory_private_region_t) * capacity);
+            if (regions == NULL)
+            {
+                FAIL_AND_TERMINATE("Call to 'realloc' returned the NULL pointer.");
+            }
+            handles->regions = regions;
+            handles->region_capacity = capacity;
+        }
+        size_t size = fancy_memory_private_mapped_length(length < FANCY_MEMORY_REGION_SIZE ? FANCY_MEMORY_REGION_SIZE : length);
+        index = handles->region_count++;
+        handles->regions[index] = (fancy_memory_private_region_t){.base = fancy_memory_private_map(size, 0), .size = size};
+    }
+    handles->active = index;
+    fancy_memory_private_region_t *target = &handles->regions[index];
+    fancy_memory_private_block_t *block = (fancy_memory_private_block_t *)(target->base + target->cursor);
+    target->cursor += length;
+    target->live_length += length;
+    target->live_count += 1;
+    *region = index;
+    return block;
+}
+
+static void fancy_memory_private_member_region_release(fancy_memory_t *self, size_t region)
+{
+    // The pages of the current region are kept, since they are about to be reused.
+    fancy_memory_private_region_t *released = &self->handles.regions[region];
+    released->cursor = 0;
+    if (region != self->handles.active)
+    {
+        (void)madvise(released->base, released->size, MADV_DONTNEED);
+    }
+}
+
+static void fancy_memory_private_member_handles_reset(fancy_memory_t *self)
+{
+    // Every handle is freed (i.e., becomes stale), and every region is unmapped.
+    fancy_memory_private_handles_t *handles = &self->handles;
+    for (size_t i = 0; i < handles->used; i++)
+    {
+        if (handles->records[i].block != NULL)
+        {
+            handles->records[i].block = NULL;
+            handles->records[i].pins = 0;
+            handles->records[i].generation += 1;
+            handles->records[i].next_free = handles->free_list;
+            handles->free_list = i + 1;
+        }
+    }
+    for (size_t i = 0; i < handles->region_count; i++)
+    {
+        if (munmap(handles->regions[i].base, handles->regions[i].size) != 0)
+        {
+            FAIL_AND_TERMINATE("Call to 'munmap' failed.");
+        }
+    }
+    handles->region_count = 0;
+    handles->count = 0;
+    handles->active = SIZE_MAX;
+    handles->source = SIZE_MAX;
+}
+
+static uint64_t fancy_memory_private_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static size_t fancy_memory_private_align(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static void fancy_memory_private_member_account_alloc(fancy_memory_t *self, size_t size, fancy_memory_site_stats_t *site)
+{
+    if (site != NULL)
+    {
+        site->live_bytes += size;
+        site->live_count += 1;
+        site->allocation_count += 1;
+        site->allocated_bytes += size;
+    }
+    self->histograms.sizes[fancy_memory_private_bucket_of(size)] += 1;
+    fancy_memory_stats_t *stats = &self->stats;
+    stats->live_bytes += size;
+    stats->live_count += 1;
+    stats->allocation_count += 1;
+    if (stats->live_bytes > stats->peak_bytes)
+    {
+        stats->peak_bytes = stats->live_bytes;
+    }
+    if (stats->live_count > stats->peak_count)
+    {
+        stats->peak_count = stats->live_count;
+    }
+    fancy_memory_private_shm_slot_t *slot = self->shm_slot;
+    if (slot != NULL)
+    {
+        fancy_memory_private_shm_begin(slot);
+        fancy_memory_private_shm_count(slot, size, 1);
+        fancy_memory_private_shm_end(slot, stats);
+    }
+    fancy_memory_private_member_roll_up(self, size, 1, 1, 0, 0);
+}
+
+static void fancy_memory_private_member_account_alloc_many(fancy_memory_t *self, size_t const *sizes, size_t count)
+{
+    fancy_memory_private_shm_slot_t *slot = self->shm_slot;
+    if (slot != NULL)
+    {
+        fancy_memory_private_shm_begin(slot);
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        self->histograms.sizes[fancy_memory_private_bucket_of(sizes[i])] += 1;
+        bytes += sizes[i];
+        if (slot != NULL)
+        {
+            fancy_memory_private_shm_count(slot, sizes[i], 1);
+        }
+    }
+    fancy_memory_stats_t *stats = &self->stats;
+    stats->live_bytes += bytes;
+    stats->live_count += count;
+    stats->allocation_count += count;
+    if (stats->live_bytes > stats->peak_bytes)
+    {
+        stats->peak_bytes = stats->live_bytes;
+    }
+    if (stats->live_count > stats->peak_count)
+    {
+        stats->peak_count = stats->live_count;
+    }
+    if (slot != NULL)
+    {
+        fancy_memory_private_shm_end(slot, stats);
+    }
+    fancy_memory_private_member_roll_up(self, bytes, count, count, 0, 0);
+}
+
+static void fancy_memory_private_member_account_free(fancy_memory_t *self, size_t size, fancy_memory_site_stats_t *site, uint64_t birth)
+{
+    self->histograms.lifetimes[fancy_memory_private_bucket_of(fancy_memory_private_member_clock(self) - birth)] += 1;
+    if (site != NULL)
+    {
+        site->live_bytes -= size;
+        site->live_count -= 1;
+    }
+    fancy_memory_stats_t *stats = &self->stats;
+    stats->live_bytes -= size;
+    stats->live_count -= 1;
+    stats->free_count += 1;
+    fancy_memory_private_shm_slot_t *slot = self->shm_slot;
+    if (slot != NULL)
+    {
+        fancy_memory_private_shm_begin(slot);
+        fancy_memory_private_shm_count(slot, size, (uint64_t)0 - 1);
+        fancy_memory_private_shm_end(slot, stats);
+    }
+    fancy_memory_private_member_roll_up(self, (size_t)0 - size, (size_t)0 - 1, 0, 1, 0);
+}
+
+static void fancy_memory_private_member_account_realloc(
+    fancy_memory_t *self, size_t old_size, size_t new_size, fancy_memory_site_stats_t *old_site, fancy_memory_site_stats_t *new_site)
+{
+    if (old_site != NULL)
+    {
+        old_site->live_bytes -= old_size;
+        old_site->live_count -= 1;
+    }
+    if (new_site != NULL)
+    {
+        new_site->live_bytes += new_size;
+        new_site->live_count += 1;
+        if (new_site != old_site)
+        {
+            new_site->allocation_count += 1;
+        }
+        new_site->allocated_bytes += new_size > old_size ? new_size - old_size : 0;
+    }
+    self->histograms.sizes[fancy_memory_private_bucket_of(new_size)] += 1;
+    fancy_memory_stats_t *stats = &self->stats;
+    stats->live_bytes = stats->live_bytes - old_size + new_size;
+    stats->reallocation_count += 1;
+    if (stats->live_bytes > stats->peak_bytes)
+    {
+        stats->peak_bytes = stats->live_bytes;
+    }
+    fancy_memory_private_shm_slot_t *slot = self->shm_slot;
+    if (slot != NULL)
+    {
+        fancy_memory_private_shm_begin(slot);
+        fancy_memory_private_shm_count(slot, old_size, (uint64_t)0 - 1);
+        fancy_memory_private_shm_count(slot, new_size, 1);
+        fancy_memory_private_shm_end(slot, stats);
+    }
+    fancy_memory_private_member_roll_up(self, new_size - old_size, 0, 0, 0, 1);
+}
+
+static void fancy_memory_private_member_roll_up(
+    fancy_memory_t *self, size_t bytes, size_t count, uint64_t allocations, uint64_t frees, uint64_t reallocations)
+{
+    // The live deltas wrap around (i.e., a decrease is passed as its two's complement),
+    // which unsigned arithmetic then undoes.
+    if (self->parent == NULL && self->children == NULL)
+    {
+        return;
+    }
+    for (fancy_memory_t *tracker = self; tracker != NULL; tracker = tracker->parent)
+    {
+        fancy_memory_stats_t *descendants = &tracker->descendants;
+        if (tracker != self)
+        {
+            descendants->live_bytes += bytes;
+            descendants->live_count += count;
+            descendants->allocation_count += allocations;
+            descendants->free_count += frees;
+            descendants->reallocation_count += reallocations;
+        }
+        size_t live_bytes = tracker->stats.live_bytes + descendants->live_bytes;
+        size_t live_count = tracker->stats.live_count + descendants->live_count;
+        if (live_bytes > descendants->peak_bytes)
+        {
+            descendants->peak_bytes = live_bytes;
+        }
+        if (live_count > descendants->peak_count)
+        {
+            descendants->peak_count = live_count;
+        }
+    }
+}
+
+static void fancy_memory_private_member_detach(fancy_memory_t *self)
+{
+    // The live blocks of the subtree leave the totals of the ancestors (which keep the
+    // cumulative counters), since they are no longer tracked through them.
+    size_t bytes = self->stats.live_bytes + self->descendants.live_bytes;
+    size_t count = self->stats.live_count + self->descendants.live_count;
+    size_t retired_bytes = self->stats.retired_bytes + self->descendants.retired_bytes;
+    size_t retired_count = self->stats.retired_count + self->descendants.retired_count;
+    for (fancy_memory_t *ancestor = self->parent; ancestor != NULL; ancestor = ancestor->parent)
+    {
+        ancestor->descendants.live_bytes -= bytes;
+        ancestor->descendants.live_count -= count;
+        ancestor->descendants.retired_bytes -= retired_bytes;
+        ancestor->descendants.retired_count -= retired_count;
+    }
+    if (self->previous_sibling != NULL)
+    {
+        self->previous_sibling->next_sibling = self->next_sibling;
+    }
+    else
+    {
+        self->parent->children = self->next_sibling;
+    }
+    if (self->next_sibling != NULL)
+    {
+        self->next_sibling->previous_sibling = self->previous_sibling;
+    }
+    self->parent = NULL;
+    self->previous_sibling = NULL;
+    self->next_sibling = NULL;
+}
+
+static size_t fancy_memory_private_member_drain(fancy_memory_t *self)
+{
+    // The relaxed load keeps the common case (i.e., no pending remote frees) down to a
+    // plain read, while the exchange synchronizes with the releasing pushes.
+    if (atomic_load_explicit(&self->remote_frees, memory_order_relaxed) == NULL)
+    {
+        return 0;
+    }
+    void *pointer = atomic_exchange_explicit(&self->remote_frees, NULL, memory_order_acquire);
+    void *batch[FANCY_MEMORY_REMOTE_BATCH_SIZE];
+    size_t n = 0;
+    size_t count = 0;
+    while (pointer != NULL)
+    {
+        // The link must be read before the block is freed (e.g., the pool backend
+        // stores its own free list link at the same place).
+        batch[n++] = pointer;
+        pointer = *(void **)pointer;
+        if (n == FANCY_MEMORY_REMOTE_BATCH_SIZE || pointer == NULL)
+        {
+            fancy_memory_free_many(self, batch, n);
+            count += n;
+            n = 0;
+        }
+    }
+    return count;
+}
+
+static fancy_memory_private_reader_t *fancy_memory_private_member_reader_of(fancy_memory_t *self)
+{
+    // The slots are only allocated by the first reader (or retirement), and the
+    // threads that lose the race free their own copy.
+    fancy_memory_private_reader_t *readers = atomic_load_explicit(&self->epochs.readers, memory_order_acquire);
+    if (readers == NULL)
+    {
+        fancy_memory_private_reader_t *new_readers = aligned_alloc(64, sizeof(fancy_memory_private_reader_t) * FANCY_MEMORY_READER_SLOTS);
+        if (new_readers == NULL)
+        {
+            FAIL_AND_TERMINATE("Call to 'aligned_alloc' returned the NULL pointer.");
+        }
+        for (size_t i = 0; i < FANCY_MEMORY_READER_SLOTS; i++)
+        {
+            atomic_init(&new_readers[i].epoch, 0);
+            atomic_init(&new_readers[i].owner, 0);
+            new_readers[i].depth = 0;
+        }
+        if (atomic_compare_exchange_strong_explicit(
+                &self->epochs.readers, &readers, new_readers, memory_order_acq_rel, memory_order_acquire))
+        {
+            readers = new_readers;
+        }
+        else
+        {
+            free(new_readers);
+        }
+    }
+    return readers;
+}
+
+static fancy_memory_private_reader_t *fancy_memory_private_member_reader_find(fancy_memory_t *self)
+{
+    // Returns the slot claimed by the calling thread, or the NULL pointer if it is not
+    // within a section.
+    fancy_memory_private_reader_t *readers = fancy_memory_private_member_reader_of(self);
+    uintptr_t id = (uintptr_t)&fancy_memory_private_reader_id;
+    if (fancy_memory_private_reader_hint.tracker == self)
+    {
+        size_t slot = fancy_memory_private_reader_hint.slot;
+        return atomic_load_explicit(&readers[slot].owner, memory_order_relaxed) == id ? &readers[slot] : NULL;
+    }
+    for (size_t i = 0; i < FANCY_MEMORY_READER_SLOTS; i++)
+    {
+        if (atomic_load_explicit(&readers[i].owner, memory_order_relaxed) == id)
+        {
+            fancy_memory_private_reader_hint.tracker = self;
+            fancy_memory_private_reader_hint.slot = i;
+            return &readers[i];
+        }
+    }
+    return NULL;
+}
+
+static fancy_memory_private_reader_t *fancy_memory_private_member_reader_claim(fancy_memory_t *self)
+{
+    // Outermost sections claim a free slot (the hinted one, if possible), waiting for one
+    // if all of them are claimed.
+    fancy_memory_private_reader_t *reader = fancy_memory_private_member_reader_find(self);
+    if (reader != NULL)
+    {
+        return reader;
+    }
+    fancy_memory_private_reader_t *readers = atomic_load_explicit(&self->epochs.readers, memory_order_acquire);
+    uintptr_t id = (uintptr_t)&fancy_memory_private_reader_id;
+    size_t hint = fancy_memory_private_reader_hint.tracker == self ? fancy_memory_private_reader_hint.slot : 0;
+    while (true)
+    {
+        for (size_t i = 0; i < FANCY_MEMORY_READER_SLOTS; i++)
+        {
+            size_t position = (hint + i) % FANCY_MEMORY_READER_SLOTS;
+            uintptr_t owner = 0;
+            if (atomic_compare_exchange_strong_explicit(&readers[position].owner, &owner, id, memory_order_acquire, memory_order_relaxed))
+            {
+                fancy_memory_private_reader_hint.tracker = self;
+                fancy_memory_private_reader_hint.slot = position;
+                return &readers[position];
+            }
+        }
+        sched_yield();
+    }
+}
+
+static size_t fancy_memory_private_member_reclaim(fancy_memory_t *self, bool forced)
+{
+    // Unless `forced`, nothing happens until enough blocks are pending. The retired
+    // blocks are freed after the lock (if any) is released, like remote frees are.
+    fancy_memory_private_epochs_t *epochs = &self->epochs;
+    if (self->shards != NULL)
+    {
+        fancy_memory_private_lock(&self->shards->stats_lock);
+    }
+    if (!forced && epochs->count < epochs->threshold)
+    {
+        if (self->shards != NULL)
+        {
+            fancy_memory_private_unlock(&self->shards->stats_lock);
+        }
+        return 0;
+    }
+    // The fence orders the (earlier) unlinking of the retired blocks before the reading
+    // of the slots, such that a reader that is not seen cannot reach these blocks anymore.
+    uint64_t oldest = atomic_fetch_add(&epochs->epoch, 1) + 1;
+    atomic_thread_fence(memory_order_seq_cst);
+    fancy_memory_private_reader_t *readers = atomic_load_explicit(&epochs->readers, memory_order_acquire);
+    for (size_t i = 0; readers != NULL && i < FANCY_MEMORY_READER_SLOTS; i++)
+    {
+        uint64_t epoch = atomic_load(&readers[i].epoch);
+        if (epoch != 0 && epoch < oldest)
+        {
+            oldest = epoch;
+        }
+    }
+    void **batch = malloc(sizeof(void *) * (epochs->count == 0 ? 1 : epochs->count));
+    if (batch == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+    }
+    size_t n = 0;
+    size_t bytes = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < epochs->count; i++)
+    {
+        if (epochs->items[i].epoch < oldest)
+        {
+            bytes += epochs->items[i].size;
+            batch[n++] = epochs->items[i].pointer;
+        }
+        else
+        {
+            epochs->items[kept++] = epochs->items[i];
+        }
+    }
+    epochs->count = kept;
+    epochs->threshold = kept + FANCY_MEMORY_RETIRE_BATCH_SIZE;
+    if (self->shards != NULL)
+    {
+        fancy_memory_private_unlock(&self->shards->stats_lock);
+        for (size_t i = 0; i < n; i++)
+        {
+            fancy_memory_private_member_concurrent_free(self, batch[i], true);
+        }
+    }
+    else
+    {
+        fancy_memory_private_member_retired_count(self, (size_t)0 - bytes, (size_t)0 - n);
+        fancy_memory_private_member_free_many(self, batch, n, true);
+    }
+    free(batch);
+    return n;
+}
+
+static void fancy_memory_private_member_retired_count(fancy_memory_t *self, size_t bytes, size_t count)
+{
+    // Like for `roll_up`, decreases are passed as their two's complement.
+    self->stats.retired_bytes += bytes;
+    self->stats.retired_count += count;
+    if (self->shm_slot != NULL)
+    {
+        fancy_memory_private_shm_begin(self->shm_slot);
+        fancy_memory_private_shm_end(self->shm_slot, &self->stats);
+    }
+    for (fancy_memory_t *ancestor = self->parent; ancestor != NULL; ancestor = ancestor->parent)
+    {
+        ancestor->descendants.retired_bytes += bytes;
+        ancestor->descendants.retired_count += count;
+    }
+}
+
+static void fancy_memory_private_member_retired_clear(fancy_memory_t *self)
+{
+    // On reset, the retired blocks are freed along with all the others.
+    if (self->shards != NULL)
+    {
+        fancy_memory_private_lock(&self->shards->stats_lock);
+    }
+    fancy_memory_private_member_retired_count(self, (size_t)0 - self->stats.retired_bytes, (size_t)0 - self->stats.retired_count);
+    self->epochs.count = 0;
+    self->epochs.threshold = FANCY_MEMORY_RETIRE_BATCH_SIZE;
+    if (self->shards != NULL)
+    {
+        fancy_memory_private_unlock(&self->shards->stats_lock);
+    }
+}
+
+static size_t fancy_memory_private_member_size_of(fancy_memory_t *self, void *pointer)
+{
+    // Returns SIZE_MAX if `pointer` is not tracked by `self` (which is not concurrent).
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        return fancy_memory_private_member_owns_header(self, pointer) ? ((fancy_memory_private_header_t *)pointer - 1)->size : SIZE_MAX;
+    }
+    ssize_t index = fancy_memory_private_member_index_of(self, pointer);
+    return index == -1 ? SIZE_MAX : self->entries[index].size;
+}
+
+static size_t fancy_memory_private_member_retire_mark(fancy_memory_t *self, void *pointer)
+{
+    // Returns the block's size (or SIZE_MAX if `pointer` is not tracked by `self`, which
+    // is not concurrent), once the block is flagged as retired.
+    bool retired = false;
+    size_t size = SIZE_MAX;
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        if (fancy_memory_private_member_owns_header(self, pointer))
+        {
+            fancy_memory_private_header_t *header = (fancy_memory_private_header_t *)pointer - 1;
+            retired = (header->tag & FANCY_MEMORY_HEADER_RETIRED) != 0;
+            header->tag |= FANCY_MEMORY_HEADER_RETIRED;
+            size = header->size;
+        }
+    }
+    else
+    {
+        ssize_t index = fancy_memory_private_member_index_of(self, pointer);
+        if (index != -1)
+        {
+            retired = self->entries[index].retired;
+            self->entries[index].retired = true;
+            size = self->entries[index].size;
+        }
+    }
+    if (retired)
+    {
+        FAIL_AND_TERMINATE("Trying to retire memory for address that has already been retired.");
+    }
+    return size;
+}
+
+static uint64_t fancy_memory_private_member_clock(fancy_memory_t const *self)
+{
+    // Lifetimes are measured in operations (i.e., calls) on the tracker, which is
+    // both cheaper and more reproducible than reading a clock.
+    return self->stats.allocation_count + self->stats.free_count + self->stats.reallocation_count;
+}
+
+static size_t fancy_memory_private_bucket_of(uint64_t value)
+{
+    return value == 0 ? 0 : (size_t)(64 - __builtin_clzll(value));
+}
+
+static void fancy_memory_private_histogram_debug(uint64_t const *buckets, char const *name, FILE *stream)
+{
+    bool empty = true;
+    for (size_t i = 0; i < FANCY_MEMORY_HISTOGRAM_BUCKETS; i++)
+    {
+        if (buckets[i] == 0)
+        {
+            continue;
+        }
+        if (empty)
+        {
+            fprintf(stream, "%s {\n", name);
+            empty = false;
+        }
+        uint64_t low = i == 0 ? 0 : UINT64_C(1) << (i - 1);
+        uint64_t high = i == 0 ? 0 : low + (low - 1);
+        fprintf(stream, "\t.[%" PRIu64 " .. %" PRIu64 "] = %" PRIu64 ",\n", low, high, buckets[i]);
+    }
+    if (!empty)
+    {
+        fprintf(stream, "}\n\n");
+    }
+}
+
+static fancy_memory_site_stats_t *fancy_memory_private_member_site_of(fancy_memory_t *self, fancy_memory_private_location_t const *location)
+{
+    if (location == NULL)
+    {
+        return NULL;
+    }
+    fancy_memory_private_sites_t *sites = &self->sites;
+    fancy_memory_site_stats_t *site = sites->last;
+    if (site != NULL && site->line == location->line && site->file == location->file && site->function == location->function)
+    {
+        return site;
+    }
+    if (sites->count > 0)
+    {
+        size_t mask = sites->capacity - 1;
+        for (size_t i = fancy_memory_private_sites_home(sites, location); sites->slots[i] != NULL; i = (i + 1) & mask)
+        {
+            site = sites->slots[i];
+            if (site->line == location->line && site->file == location->file && site->function == location->function)
+            {
+                sites->last = site;
+                return site;
+            }
+        }
+    }
+    site = malloc(sizeof(fancy_memory_site_stats_t));
+    if (site == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'malloc' returned the NULL pointer.");
+    }
+    *site = (fancy_memory_site_stats_t){.file = location->file, .line = location->line, .function = location->function};
+    fancy_memory_private_member_sites_insert(self, site);
+    sites->last = site;
+    return site;
+}
+
+static void fancy_memory_private_member_sites_insert(fancy_memory_t *self, fancy_memory_site_stats_t *site)
+{
+    fancy_memory_private_sites_t *sites = &self->sites;
+    if ((sites->count + 1) * 2 > sites->capacity)
+    {
+        // Sites are few and long-lived, so the table is simply rebuilt when it grows.
+        fancy_memory_private_sites_t grown = {0};
+        grown.capacity = sites->capacity == 0 ? FANCY_MEMORY_SITES_MIN_CAPACITY : sites->capacity * 2;
+        grown.slots = calloc(grown.capacity, sizeof(fancy_memory_site_stats_t *));
+        if (grown.slots == NULL)
+        {
+            FAIL_AND_TERMINATE("Call to 'calloc' returned the NULL pointer.");
+        }
+        fancy_memory_private_sites_t previous = *sites;
+        *sites = grown;
+        for (size_t i = 0; i < previous.capacity; i++)
+        {
+            if (previous.slots[i] != NULL)
+            {
+                fancy_memory_private_member_sites_insert(self, previous.slots[i]);
+            }
+        }
+        free(previous.slots);
+    }
+    fancy_memory_private_location_t location = {site->file, site->line, site->function};
+    size_t mask = sites->capacity - 1;
+    size_t i = fancy_memory_private_sites_home(sites, &location);
+    while (sites->slots[i] != NULL)
+    {
+        i = (i + 1) & mask;
+    }
+    sites->slots[i] = site;
+    sites->count += 1;
+}
+
+static size_t fancy_memory_private_sites_home(fancy_memory_private_sites_t const *sites, fancy_memory_private_location_t const *location)
+{
+    uint64_t hash = (uint64_t)(uintptr_t)location->file ^ ((uint64_t)(uintptr_t)location->function << 1) ^
+                    ((uint64_t)(unsigned int)location->line << 32);
+    hash *= UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t)(hash >> 32) & (sites->capacity - 1);
+}
+
+static size_t fancy_memory_private_member_collect_sites(fancy_memory_t const *self, fancy_memory_site_stats_t *sites, size_t count)
+{
+    // Returns the number of site records; these are only copied if `sites` is not NULL
+    // (and up to `count` of them).
+    size_t n = 0;
+    if (self->shards != NULL)
+    {
+        for (size_t i = 0; i < self->shards->count; i++)
+        {
+            fancy_memory_private_lock(&self->shards->items[i].lock);
+            n += fancy_memory_private_member_collect_sites(
+                self->shards->items[i].tracker, sites == NULL ? NULL : sites + n, sites == NULL ? 0 : count - n);
+            fancy_memory_private_unlock(&self->shards->items[i].lock);
+        }
+        return n;
+    }
+    for (size_t i = 0; i < self->sites.capacity; i++)
+    {
+        if (self->sites.slots[i] != NULL)
+        {
+            if (sites != NULL)
+            {
+                if (n == count)
+                {
+                    break;
+                }
+                sites[n] = *self->sites.slots[i];
+            }
+            n += 1;
+        }
+    }
+    return n;
+}
+
+static int fancy_memory_private_compare_site_locations(void const *a, void const *b)
+{
+    fancy_memory_site_stats_t const *x = a;
+    fancy_memory_site_stats_t const *y = b;
+    int result = strcmp(x->file, y->file);
+    if (result == 0)
+    {
+        result = (x->line > y->line) - (x->line < y->line);
+    }
+    if (result == 0)
+    {
+        result = strcmp(x->function, y->function);
+    }
+    return result;
+}
+
+static int fancy_memory_private_compare_site_live_bytes(void const *a, void const *b)
+{
+    fancy_memory_site_stats_t const *x = a;
+    fancy_memory_site_stats_t const *y = b;
+    if (x->live_bytes != y->live_bytes)
+    {
+        return (x->live_bytes < y->live_bytes) - (x->live_bytes > y->live_bytes);
+    }
+    if (x->allocated_bytes != y->allocated_bytes)
+    {
+        return (x->allocated_bytes < y->allocated_bytes) - (x->allocated_bytes > y->allocated_bytes);
+    }
+    return fancy_memory_private_compare_site_locations(a, b);
+}
+
+static ssize_t fancy_memory_private_member_index_of(fancy_memory_t *self, void *pointer)
+{
+    fancy_memory_private_slot_t const *slot = fancy_memory_private_member_index_find(self, pointer);
+    if (slot == NULL)
+    {
+        return -1;
+    }
+    return (ssize_t)slot->value;
+}
+
+static void fancy_memory_private_member_track(fancy_memory_t *self, void *pointer, size_t size, unsigned int kind, fancy_memory_site_stats_t *site)
+{
+    size_t index = fancy_memory_private_member_next_index(self);
+    self->entries[index].pointer = pointer;
+    self->entries[index].size = size;
+    self->entries[index].kind = kind;
+    self->entries[index].retired = false;
+    self->entries[index].site = site;
+    self->entries[index].birth = fancy_memory_private_member_clock(self);
+    fancy_memory_private_member_index_insert(self, pointer, index);
+}
+
+static void fancy_memory_private_member_untrack(fancy_memory_t *self, size_t index)
+{
+    fancy_memory_private_member_index_erase(self, self->entries[index].pointer);
+
+    // The last item is moved into the freed position (instead of shifting every
+    // following item down by one), so only that item's index entry needs updating.
+    size_t last = self->n - 1;
+    if (index != last)
+    {
+        self->entries[index] = self->entries[last];
+        fancy_memory_private_member_index_find(self, self->entries[index].pointer)->value = index;
+    }
+    self->n -= 1;
+
+    if (self->capacity > FANCY_MEMORY_ENTRIES_MIN_CAPACITY && self->capacity > self->reserved &&
+        self->n * 4 < self->capacity)
+    {
+        size_t capacity = self->capacity / 2;
+        fancy_memory_private_member_set_capacity(self, capacity < self->reserved ? self->reserved : capacity);
+    }
+}
+
+static fancy_memory_private_shard_t *fancy_memory_private_member_shard_of(fancy_memory_t const *self, uintptr_t address)
+{
+    if (self->shards->bits == 0)
+    {
+        return &self->shards->items[0];
+    }
+    uint64_t hash = (uint64_t)(address >> FANCY_MEMORY_SHARD_RANGE_BITS) * UINT64_C(0xC2B2AE3D27D4EB4F);
+    return &self->shards->items[hash >> (64 - self->shards->bits)];
+}
+
+static void *fancy_memory_private_member_concurrent_malloc(
+    fancy_memory_t *self, size_t size, size_t alignment, bool zeroed, fancy_memory_private_location_t const *location)
+{
+    unsigned int kind = FANCY_MEMORY_KIND_GUARDED;
+    void *pointer = fancy_memory_private_member_sampled(self, alignment)
+                        ? fancy_memory_private_guarded_acquire(size, alignment)
+                        : fancy_memory_private_system_acquire(size, alignment, zeroed, self->large_threshold, &kind);
+    fancy_memory_private_shard_t *shard = fancy_memory_private_member_shard_of(self, (uintptr_t)pointer);
+    fancy_memory_private_lock(&shard->lock);
+    fancy_memory_site_stats_t *site = fancy_memory_private_member_site_of(shard->tracker, location);
+    fancy_memory_private_member_track(shard->tracker, pointer, size, kind, site);
+    fancy_memory_private_member_account_alloc(shard->tracker, size, site);
+    fancy_memory_private_unlock(&shard->lock);
+    return pointer;
+}
+
+static bool fancy_memory_private_member_concurrent_free(fancy_memory_t *self, void *pointer, bool retired)
+{
+    // Retired blocks leave the retired totals of their shard in the same critical section
+    // as its live totals, such that the merged statistics never count them twice.
+    fancy_memory_private_shard_t *shard = fancy_memory_private_member_shard_of(self, (uintptr_t)pointer);
+    fancy_memory_private_lock(&shard->lock);
+    ssize_t index = fancy_memory_private_member_index_of(shard->tracker, pointer);
+    if (index == -1)
+    {
+        fancy_memory_private_unlock(&shard->lock);
+        return false;
+    }
+    if (shard->tracker->entries[index].retired && !retired)
+    {
+        FAIL_AND_TERMINATE("Trying to free memory for address that has been retired.");
+    }
+    size_t size = shard->tracker->entries[index].size;
+    unsigned int kind = shard->tracker->entries[index].kind;
+    fancy_memory_private_member_account_free(shard->tracker, size, shard->tracker->entries[index].site, shard->tracker->entries[index].birth);
+    fancy_memory_private_member_untrack(shard->tracker, (size_t)index);
+    if (retired)
+    {
+        fancy_memory_private_member_retired_count(shard->tracker, (size_t)0 - size, (size_t)0 - 1);
+    }
+    fancy_memory_private_unlock(&shard->lock);
+    if (kind == FANCY_MEMORY_KIND_GUARDED)
+    {
+        fancy_memory_private_member_quarantine(self, pointer, size);
+    }
+    else
+    {
+        fancy_memory_private_system_release(pointer, size, kind);
+    }
+    return true;
+}
+
+static size_t fancy_memory_private_member_concurrent_retire(fancy_memory_t *self, void *pointer)
+{
+    // Returns the block's size (or SIZE_MAX if `pointer` is not tracked by `self`), once
+    // it has moved from the live totals of its shard to the retired ones.
+    fancy_memory_private_shard_t *shard = fancy_memory_private_member_shard_of(self, (uintptr_t)pointer);
+    fancy_memory_private_lock(&shard->lock);
+    size_t size = fancy_memory_private_member_retire_mark(shard->tracker, pointer);
+    if (size != SIZE_MAX)
+    {
+        fancy_memory_private_member_retired_count(shard->tracker, size, 1);
+    }
+    fancy_memory_private_unlock(&shard->lock);
+    return size;
+}
+
+static void *fancy_memory_private_member_concurrent_realloc(fancy_memory_t *self, void *pointer, size_t size, fancy_memory_private_location_t const *location)
+{
+    // The block leaves the index of its shard before calling `realloc`, since, once it
+    // has been released, its address may be handed out (and tracked) by another thread.
+    // Its bytes stay counted until the new block is, such that the merged totals never
+    // miss them (when the block moves to another shard, they briefly count both blocks).
+    fancy_memory_private_shard_t *shard = fancy_memory_private_member_shard_of(self, (uintptr_t)pointer);
+    fancy_memory_private_lock(&shard->lock);
+    ssize_t index = fancy_memory_private_member_index_of(shard->tracker, pointer);
+    if (index == -1)
+    {
+        fancy_memory_private_unlock(&shard->lock);
+        return NULL;
+    }
+    if (shard->tracker->entries[index].retired)
+    {
+        FAIL_AND_TERMINATE("Trying to reallocate memory for address that has been retired.");
+    }
+    size_t old_size = shard->tracker->entries[index].size;
+    fancy_memory_site_stats_t *old_site = shard->tracker->entries[index].site;
+    uint64_t birth = shard->tracker->entries[index].birth;
+    unsigned int kind = shard->tracker->entries[index].kind;
+    fancy_memory_private_location_t old_location = {0};
+    if (old_site != NULL)
+    {
+        // Site records belong to a shard, so the location is carried over instead.
+        old_location = (fancy_memory_private_location_t){old_site->file, old_site->line, old_site->function};
+        if (location == NULL)
+        {
+            location = &old_location;
+        }
+    }
+    fancy_memory_private_member_untrack(shard->tracker, (size_t)index);
+    fancy_memory_private_unlock(&shard->lock);
+
+    void *new_pointer = kind == FANCY_MEMORY_KIND_GUARDED
+                            ? fancy_memory_private_member_guarded_resize(self, pointer, old_size, size)
+                            : fancy_memory_private_system_resize(pointer, old_size, size, self->large_threshold, &kind);
+
+    fancy_memory_private_shard_t *new_shard = fancy_memory_private_member_shard_of(self, (uintptr_t)new_pointer);
+    fancy_memory_private_lock(&new_shard->lock);
+    if (new_shard == shard)
+    {
+        fancy_memory_private_member_account_leave(shard->tracker, old_size, old_site);
+    }
+    fancy_memory_site_stats_t *site = fancy_memory_private_member_site_of(new_shard->tracker, location);
+    if (site != NULL)
+    {
+        site->live_bytes += size;
+        site->live_count += 1;
+        bool moved = old_site == NULL || site->file != old_location.file || site->line != old_location.line ||
+                     site->function != old_location.function;
+        site->allocation_count += moved ? 1 : 0;
+        site->allocated_bytes += size > old_size ? size - old_size : 0;
+    }
+    fancy_memory_private_member_track(new_shard->tracker, new_pointer, size, kind, site);
+    // The block keeps its birth, which is only approximate if it moved to another shard.
+    new_shard->tracker->entries[new_shard->tracker->n - 1].birth = birth;
+    new_shard->tracker->histograms.sizes[fancy_memory_private_bucket_of(size)] += 1;
+    fancy_memory_stats_t *stats = &new_shard->tracker->stats;
+    stats->live_bytes += size;
+    stats->live_count += 1;
+    stats->reallocation_count += 1;
+    if (stats->live_bytes > stats->peak_bytes)
+    {
+        stats->peak_bytes = stats->live_bytes;
+    }
+    if (stats->live_count > stats->peak_count)
+    {
+        stats->peak_count = stats->live_count;
+    }
+    if (new_shard->tracker->shm_slot != NULL)
+    {
+        fancy_memory_private_shm_begin(new_shard->tracker->shm_slot);
+        fancy_memory_private_shm_count(new_shard->tracker->shm_slot, size, 1);
+        fancy_memory_private_shm_end(new_shard->tracker->shm_slot, stats);
+    }
+    fancy_memory_private_unlock(&new_shard->lock);
+    if (new_shard != shard)
+    {
+        fancy_memory_private_lock(&shard->lock);
+        fancy_memory_private_member_account_leave(shard->tracker, old_size, old_site);
+        fancy_memory_private_unlock(&shard->lock);
+    }
+    return new_pointer;
+}
+
+static void fancy_memory_private_member_account_leave(fancy_memory_t *self, size_t size, fancy_memory_site_stats_t *site)
+{
+    // Removes a block that moved (i.e., was reallocated) to another place from the
+    // live totals of `self` (a shard), which is not a free.
+    if (site != NULL)
+    {
+        site->live_bytes -= size;
+        site->live_count -= 1;
+    }
+    self->stats.live_bytes -= size;
+    self->stats.live_count -= 1;
+    if (self->shm_slot != NULL)
+    {
+        fancy_memory_private_shm_begin(self->shm_slot);
+        fancy_memory_private_shm_count(self->shm_slot, size, (uint64_t)0 - 1);
+        fancy_memory_private_shm_end(self->shm_slot, &self->stats);
+    }
+}
+
+static void fancy_memory_private_member_concurrent_stats(fancy_memory_t const *self, fancy_memory_stats_t *stats)
+{
+    fancy_memory_private_shards_t *shards = self->shards;
+    *stats = (fancy_memory_stats_t){0};
+    for (size_t i = 0; i < shards->count; i++)
+    {
+        fancy_memory_private_lock(&shards->items[i].lock);
+        fancy_memory_stats_t const *shard_stats = &shards->items[i].tracker->stats;
+        stats->live_bytes += shard_stats->live_bytes;
+        stats->live_count += shard_stats->live_count;
+        stats->allocation_count += shard_stats->allocation_count;
+        stats->free_count += shard_stats->free_count;
+        stats->reallocation_count += shard_stats->reallocation_count;
+        stats->retired_bytes += shard_stats->retired_bytes;
+        stats->retired_count += shard_stats->retired_count;
+        // The shards peak at different times, so the sum of their peaks is an upper bound.
+        stats->peak_bytes += shard_stats->peak_bytes;
+        stats->peak_count += shard_stats->peak_count;
+        fancy_memory_private_unlock(&shards->items[i].lock);
+    }
+    // Each shard's retired blocks are part of its live totals (read in the same section).
+    stats->live_bytes -= stats->retired_bytes;
+    stats->live_count -= stats->retired_count;
+}
+
+static void fancy_memory_private_member_concurrent_debug(fancy_memory_t const *self, FILE *stream)
+{
+    fprintf(stream, "\nfancy_memory_t[%zu shards] {\n", self->shards->count);
+    fancy_memory_private_debug_context_t context = {.stream = stream, .index = 0, .total_size = 0};
+    fancy_memory_foreach(self, fancy_memory_private_debug_block, &context);
+    fprintf(stream, "} [total size = %zu]\n\n", context.total_size);
+    fancy_memory_histograms_t histograms;
+    fancy_memory_get_histograms(self, &histograms);
+    fancy_memory_private_histogram_debug(histograms.sizes, "sizes [bytes]", stream);
+    fancy_memory_private_histogram_debug(histograms.lifetimes, "lifetimes [operations]", stream);
+}
+
+static bool fancy_memory_private_member_visit(
+    fancy_memory_t const *self, size_t min_size, size_t max_size, fancy_memory_visitor_t visitor, void *context, size_t *count)
+{
+    // Returns `false` if the visitor asked to stop.
+    fancy_memory_block_t block;
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        for (fancy_memory_private_header_t const *header = self->head; header != NULL; header = header->next)
+        {
+            if (header->size < min_size || header->size > max_size)
+            {
+                continue;
+            }
+            block.address = (void *)(header + 1);
+            block.size = header->size;
+            block.site = header->site;
+            (*count)++;
+            if (!visitor(&block, context))
+            {
+                return false;
+            }
+        }
+        return fancy_memory_private_member_visit_handles(self, min_size, max_size, visitor, context, count);
+    }
+    for (size_t i = 0; i < self->n; i++)
+    {
+        fancy_memory_private_entry_t const *entry = &self->entries[i];
+        if (entry->size < min_size || entry->size > max_size)
+        {
+            continue;
+        }
+        block.address = entry->pointer;
+        block.size = entry->size;
+        block.site = entry->site;
+        (*count)++;
+        if (!visitor(&block, context))
+        {
+            return false;
+        }
+    }
+    return fancy_memory_private_member_visit_handles(self, min_size, max_size, visitor, context, count);
+}
+
+static bool fancy_memory_private_member_visit_handles(
+    fancy_memory_t const *self, size_t min_size, size_t max_size, fancy_memory_visitor_t visitor, void *context, size_t *count)
+{
+    fancy_memory_block_t block;
+    for (size_t i = 0; i < self->handles.used; i++)
+    {
+        fancy_memory_private_record_t const *record = &self->handles.records[i];
+        if (record->block == NULL || record->size < min_size || record->size > max_size)
+        {
+            continue;
+        }
+        block.address = (void *)(record->block + 1);
+        block.size = record->size;
+        block.site = NULL;
+        (*count)++;
+        if (!visitor(&block, context))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool fancy_memory_private_member_step(fancy_memory_t const *self, fancy_memory_iterator_t *iterator, fancy_memory_block_t *block)
+{
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        // The next header is kept (rather than the current one), such that the block
+        // that was just returned can be freed before the next step.
+        fancy_memory_private_header_t const *header = iterator->position == 0 ? self->head : iterator->header;
+        iterator->position = 1;
+        while (header != NULL && (header->size < iterator->min_size || header->size > iterator->max_size))
+        {
+            header = header->next;
+        }
+        if (header != NULL)
+        {
+            iterator->header = header->next;
+            block->address = (void *)(header + 1);
+            block->size = header->size;
+            block->site = header->site;
+            return true;
+        }
+        iterator->header = NULL;
+    }
+    else
+    {
+        while (iterator->position < self->n)
+        {
+            fancy_memory_private_entry_t const *entry = &self->entries[iterator->position++];
+            if (entry->size >= iterator->min_size && entry->size <= iterator->max_size)
+            {
+                block->address = entry->pointer;
+                block->size = entry->size;
+                block->site = entry->site;
+                return true;
+            }
+        }
+    }
+    // The blocks allocated through handles come last.
+    while (iterator->handle < self->handles.used)
+    {
+        fancy_memory_private_record_t const *record = &self->handles.records[iterator->handle++];
+        if (record->block != NULL && record->size >= iterator->min_size && record->size <= iterator->max_size)
+        {
+            block->address = (void *)(record->block + 1);
+            block->size = record->size;
+            block->site = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool fancy_memory_private_debug_block(fancy_memory_block_t const *block, void *context)
+{
+    fancy_memory_private_debug_context_t *debug = context;
+    fprintf(debug->stream, "\t.[%zu] = { address = %p, size = %zu },\n", debug->index++, block->address, block->size);
+    debug->total_size += block->size;
+    return true;
+}
+
+static void fancy_memory_private_member_shm_refresh(fancy_memory_t *self)
+{
+    // Rewrites the whole slot (e.g., once published, or reset), whose live counts are
+    // recomputed from the tracked blocks.
+    fancy_memory_private_shm_slot_t *slot = self->shm_slot;
+    fancy_memory_private_shm_begin(slot);
+    for (size_t i = 0; i < FANCY_MEMORY_HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_store_explicit(&slot->live_counts[i], 0, memory_order_relaxed);
+    }
+    fancy_memory_foreach(self, fancy_memory_private_shm_count_block, slot);
+    fancy_memory_private_shm_end(slot, &self->stats);
+}
+
+static bool fancy_memory_private_shm_count_block(fancy_memory_block_t const *block, void *context)
+{
+    fancy_memory_private_shm_count(context, block->size, 1);
+    return true;
+}
+
+static void fancy_memory_private_shm_begin(fancy_memory_private_shm_slot_t *slot)
+{
+    uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void fancy_memory_private_shm_count(fancy_memory_private_shm_slot_t *slot, size_t size, uint64_t delta)
+{
+    // The slot only has one writer, so the count is not updated atomically (i.e., it
+    // is only stored atomically, for the readers' sake).
+    _Atomic(uint64_t) *count = &slot->live_counts[fancy_memory_private_bucket_of(size)];
+    atomic_store_explicit(count, atomic_load_explicit(count, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+static void fancy_memory_private_shm_end(fancy_memory_private_shm_slot_t *slot, fancy_memory_stats_t const *stats)
+{
+    // The stats are those of a single tracker (or shard), which still count its retired
+    // blocks as live.
+    atomic_store_explicit(&slot->live_bytes, stats->live_bytes - stats->retired_bytes, memory_order_relaxed);
+    atomic_store_explicit(&slot->live_count, stats->live_count - stats->retired_count, memory_order_relaxed);
+    atomic_store_explicit(&slot->peak_bytes, stats->peak_bytes, memory_order_relaxed);
+    atomic_store_explicit(&slot->peak_count, stats->peak_count, memory_order_relaxed);
+    atomic_store_explicit(&slot->allocation_count, stats->allocation_count, memory_order_relaxed);
+    atomic_store_explicit(&slot->free_count, stats->free_count, memory_order_relaxed);
+    atomic_store_explicit(&slot->reallocation_count, stats->reallocation_count, memory_order_relaxed);
+    uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_release);
+}
+
+static void fancy_memory_private_member_snapshot_entries(fancy_memory_t const *self, fancy_memory_private_writer_t *writer)
+{
+    // The entries of the descendants are included, like their totals are in the stats.
+    for (fancy_memory_t const *child = self->children; child != NULL; child = child->next_sibling)
+    {
+        fancy_memory_private_member_snapshot_entries(child, writer);
+    }
+    size_t handle_count = self->handles.count;
+    if (handle_count > 0)
+    {
+        fancy_memory_private_writer_u64(writer, handle_count);
+        for (size_t i = 0; i < self->handles.used; i++)
+        {
+            if (self->handles.records[i].block != NULL)
+            {
+                fancy_memory_private_writer_u64(writer, (uintptr_t)(self->handles.records[i].block + 1));
+                fancy_memory_private_writer_u64(writer, self->handles.records[i].size);
+            }
+        }
+    }
+    // Like the totals (see `fancy_memory_get_stats`), the entries leave out the retired
+    // blocks still pending.
+    size_t count = self->stats.live_count - self->stats.retired_count - handle_count;
+    if (count == 0)
+    {
+        return;
+    }
+    fancy_memory_private_writer_u64(writer, count);
+    if (self->backend == FANCY_MEMORY_BACKEND_ARENA || self->backend == FANCY_MEMORY_BACKEND_HEADER)
+    {
+        for (fancy_memory_private_header_t const *header = self->head; header != NULL; header = header->next)
+        {
+            if ((header->tag & FANCY_MEMORY_HEADER_RETIRED) == 0)
+            {
+                fancy_memory_private_writer_u64(writer, (uintptr_t)(header + 1));
+                fancy_memory_private_writer_u64(writer, header->size);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < self->n; i++)
+        {
+            if (!self->entries[i].retired)
+            {
+                fancy_memory_private_writer_u64(writer, (uintptr_t)self->entries[i].pointer);
+                fancy_memory_private_writer_u64(writer, self->entries[i].size);
+            }
+        }
+    }
+}
+
+static void fancy_memory_private_writer_bytes(fancy_memory_private_writer_t *writer, void const *bytes, size_t size)
+{
+    while (size > 0)
+    {
+        if (writer->length == FANCY_MEMORY_SNAPSHOT_BUFFER_SIZE)
+        {
+            fancy_memory_private_writer_flush(writer);
+        }
+        size_t available = FANCY_MEMORY_SNAPSHOT_BUFFER_SIZE - writer->length;
+        size_t n = size < available ? size : available;
+        memcpy(writer->buffer + writer->length, bytes, n);
+        writer->length += n;
+        bytes = (unsigned char const *)bytes + n;
+        size -= n;
+    }
+}
+
+static void fancy_memory_private_writer_u64(fancy_memory_private_writer_t *writer, uint64_t value)
+{
+    unsigned char bytes[8];
+    for (size_t i = 0; i < 8; i++)
+    {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+    fancy_memory_private_writer_bytes(writer, bytes, 8);
+}
+
+static void fancy_memory_private_writer_string(fancy_memory_private_writer_t *writer, char const *string)
+{
+    size_t length = strlen(string);
+    fancy_memory_private_writer_u64(writer, length);
+    fancy_memory_private_writer_bytes(writer, string, length);
+}
+
+static void fancy_memory_private_writer_flush(fancy_memory_private_writer_t *writer)
+{
+    // After a failed write, the rest of the snapshot is discarded (the caller is only
+    // told at the end), since a partial snapshot cannot be read anyway.
+    if (!writer->failed && writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->stream) != writer->length)
+    {
+        writer->failed = true;
+    }
+    writer->length = 0;
+}
+
+static void fancy_memory_private_lock(pthread_mutex_t *lock)
+{
+    if (pthread_mutex_lock(lock) != 0)
+    {
+        FAIL_AND_TERMINATE("Call to 'pthread_mutex_lock' failed.");
+    }
+}
+
+static void fancy_memory_private_unlock(pthread_mutex_t *lock)
+{
+    if (pthread_mutex_unlock(lock) != 0)
+    {
+        FAIL_AND_TERMINATE("Call to 'pthread_mutex_unlock' failed.");
+    }
+}
+
+static void fancy_memory_private_member_index_insert(fancy_memory_t *self, void *key, size_t value)
+{
+    fancy_memory_private_member_index_migrate(self, FANCY_MEMORY_INDEX_MIGRATION_STEP);
+    size_t count = self->index.count + self->previous_index.count + 1;
+    if (count * 2 > self->index.capacity)
+    {
+        size_t capacity = self->index.capacity * 2;
+        fancy_memory_private_member_index_resize(
+            self, capacity < FANCY_MEMORY_INDEX_MIN_CAPACITY ? FANCY_MEMORY_INDEX_MIN_CAPACITY : capacity);
+    }
+    fancy_memory_private_table_insert(&self->index, key, value);
+}
+
+static fancy_memory_private_slot_t *fancy_memory_private_member_index_find(fancy_memory_t *self, void const *key)
+{
+    ssize_t position = fancy_memory_private_table_position_of(&self->index, key);
+    if (position != -1)
+    {
+        return &self->index.slots[position];
+    }
+    position = fancy_memory_private_table_position_of(&self->previous_index, key);
+    if (position != -1)
+    {
+        return &self->previous_index.slots[position];
+    }
+    return NULL;
+}
+
+static void fancy_memory_private_member_index_erase(fancy_memory_t *self, void const *key)
+{
+    ssize_t position = fancy_memory_private_table_position_of(&self->index, key);
+    if (position != -1)
+    {
+        fancy_memory_private_table_erase_at(&self->index, (size_t)position);
+    }
+    else
+    {
+        position = fancy_memory_private_table_position_of(&self->previous_index, key);
+        if (position != -1)
+        {
+            fancy_memory_private_table_erase_at(&self->previous_index, (size_t)position);
+        }
+    }
+    fancy_memory_private_member_index_migrate(self, FANCY_MEMORY_INDEX_MIGRATION_STEP);
+    size_t count = self->index.count + self->previous_index.count;
+    if (self->index.capacity > FANCY_MEMORY_INDEX_SHRINK_MIN_CAPACITY && count * 8 < self->index.capacity &&
+        self->index.capacity > self->reserved * 2 && self->previous_index.slots == NULL)
+    {
+        fancy_memory_private_member_index_resize(self, self->index.capacity / 2);
+    }
+}
+
+static void fancy_memory_private_member_index_resize(fancy_memory_t *self, size_t capacity)
+{
+    // Only one migration can be in progress at a time, and insertions and deletions
+    // never start one before the previous one has finished (see the step's comment).
+    assert(self->previous_index.slots == NULL);
+    self->previous_index = self->index;
+    self->migration_position = 0;
+    fancy_memory_private_table_init(&self->index, capacity);
+    if (self->previous_index.count == 0)
+    {
+        fancy_memory_private_member_index_migrate(self, SIZE_MAX);
+    }
+}
+
+static void fancy_memory_private_member_index_migrate(fancy_memory_t *self, size_t budget)
+{
+    fancy_memory_private_table_t *previous = &self->previous_index;
+    // Invariant: every item still held by the previous table lives at a position
+    // greater than or equal to `migration_position`. Erasing the item found at that
+    // position may shift a following item into it, which is why the position is
+    // only advanced when an empty slot is found.
+    while (previous->slots != NULL && budget > 0)
+    {
+        if (previous->count == 0)
+        {
+            fancy_memory_private_table_release(previous);
+            self->migration_position = 0;
+            return;
+        }
+        fancy_memory_private_slot_t *slot = &previous->slots[self->migration_position];
+        if (slot->key == NULL)
+        {
+            self->migration_position += 1;
+            size_t span = FANCY_MEMORY_HUGE_PAGE_SIZE / sizeof(fancy_memory_private_slot_t);
+            if (previous->capacity * sizeof(fancy_memory_private_slot_t) >= FANCY_MEMORY_HUGE_PAGE_SIZE &&
+                self->migration_position % span == 0)
+            {
+                // This is only a hint, since the released slots are already empty.
+                (void)madvise(previous->slots + self->migration_position - span, FANCY_MEMORY_HUGE_PAGE_SIZE, MADV_DONTNEED);
+            }
+        }
+        else
+        {
+            fancy_memory_private_table_insert(&self->index, slot->key, slot->value);
+            fancy_memory_private_table_erase_at(previous, self->migration_position);
+        }
+        budget -= 1;
+    }
+}
+
+static void fancy_memory_private_table_init(fancy_memory_private_table_t *table, size_t capacity)
+{
+    table->slots = NULL;
+    table->capacity = capacity;
+    table->count = 0;
+    table->bits = 0;
+    if (capacity == 0)
+    {
+        return;
+    }
+    size_t size = capacity * sizeof(fancy_memory_private_slot_t);
+    table->slots = size >= FANCY_MEMORY_INDEX_MAPPED_SIZE ? fancy_memory_private_map(size, 0) : calloc(capacity, sizeof(fancy_memory_private_slot_t));
+    if (table->slots == NULL)
+    {
+        FAIL_AND_TERMINATE("Call to 'calloc' returned the NULL pointer.");
+    }
+    while (((size_t)1 << table->bits) < capacity)
+    {
+        table->bits += 1;
+    }
+}
+
+static void fancy_memory_private_table_release(fancy_memory_private_table_t *table)
+{
+    size_t size = table->capacity * sizeof(fancy_memory_private_slot_t);
+    if (table->slots != NULL && size >= FANCY_MEMORY_INDEX_MAPPED_SIZE)
+    {
+        if (munmap(table->slots, fancy_memory_private_mapped_length(size)) != 0)
+        {
+            FAIL_AND_TERMINATE("Call to 'munmap' failed.");
+        }
+    }
+    else
+    {
+        free(table->slots);
+    }
+    fancy_memory_private_table_init(table, 0);
+}
+
+static size_t fancy_memory_private_table_home(fancy_memory_private_table_t const *table, void const *key)
+{
+    // Fibonacci hashing: the multiplication mixes the (mostly aligned, hence
+    // low-entropy) low address bits into the high bits, which are the ones kept.
+    uint64_t hash = (uint64_t)(uintptr_t)key * UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t)(hash >> (64 - table->bits));
+}
+
+static ssize_t fancy_memory_private_table_position_of(fancy_memory_private_table_t const *table, void const *key)
+{
+    if (table->count == 0)
+    {
+        return -1;
+    }
+    size_t mask = table->capacity - 1;
+    for (size_t i = fancy_memory_private_table_home(table, key);; i = (i + 1) & mask)
+    {
+        if (table->slots[i].key == key)
+        {
+            return (ssize_t)i;
+        }
+        if (table->slots[i].key == NULL)
+        {
+            return -1;
+        }
+    }
+}
+
+static void fancy_memory_private_table_insert(fancy_memory_private_table_t *table, void *key, size_t value)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = fancy_memory_private_table_home(table, key);
+    while (table->slots[i].key != NULL)
+    {
+        i = (i + 1) & mask;
+    }
+    table->slots[i].key = key;
+    table->slots[i].value = value;
+    table->count += 1;
+}
+
+static void fancy_memory_private_table_erase_at(fancy_memory_private_table_t *table, size_t position)
+{
+    // Backward-shift deletion: following items of the same probe cluster are moved
+    // into the hole whenever their home position allows it, which keeps every probe
+    // sequence contiguous without the need for tombstones.
+    size_t mask = table->capacity - 1;
+    size_t hole = position;
+    for (size_t i = (position + 1) & mask; table->slots[i].key != NULL; i = (i + 1) & mask)
+    {
+        size_t home = fancy_memory_private_table_home(table, table->slots[i].key);
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
     }
+    table->slots[hole].key = NULL;
+    table->count -= 1;
 }
@@ -0,0 +1,373 @@
+/*
+    Copyright (c) 2023 BB-301 <fw3dg3@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the “Software”), to deal in the Software without restriction,
+    including without limitation the rights to use, copy, modify, merge,
+    publish, distribute, sublicense, and/or sell copies of the Software,
+    and to permit persons to whom the Software is furnished to do so,
+    subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    An `LD_PRELOAD` shim that routes the process' `malloc`, `calloc`, `realloc`,
+    `reallocarray`, `free`, `posix_memalign`, `aligned_alloc`, `memalign`, `valloc`,
+    `pvalloc` and `malloc_usable_size` calls through a single, process-wide concurrent
+    tracker, such that the memory of code that cannot be changed (e.g., third-party
+    libraries) gets tracked too:
+
+        make preload_build
+        LD_PRELOAD=./build/libfancy_memory_preload.so <command>
+
+    The tracker itself allocates through these same functions, so each thread has a
+    (thread-local) flag that is set while it runs tracker code. Calls made while that
+    flag is set (including those made while creating the tracker, on the first call)
+    are served directly by the C library's allocator (i.e., `__libc_malloc` and
+    friends), without being tracked. Pointers that are not tracked (e.g., those
+    allocated before the shim was loaded) are handed back to the C library as well.
+
+    The tracker's locks are all taken before the process forks (and released in both
+    the parent and the child), such that the child never inherits a lock held by a
+    thread that does not exist there.
+
+    The statistics are written, as a JSON line, when the process exits, as well as
+    after the signal (if any) selected by the following environment variables:
+
+        FANCY_MEMORY_PRELOAD_SIGNAL   A signal number (e.g., 12 for SIGUSR2) after which
+                                      the statistics are written, by the next thread
+                                      that allocates or frees memory.
+        FANCY_MEMORY_PRELOAD_OUTPUT   A file to which the statistics are appended
+                                      (instead of `stderr`).
+        FANCY_MEMORY_PRELOAD_SNAPSHOT A file to which a snapshot (see
+                                      `fancy_memory_snapshot_write`) is written along
+                                      with the statistics.
+        FANCY_MEMORY_PRELOAD_SHARDS   The number of shards of the tracker (see
+                                      `fancy_memory_create_concurrent`).
+        FANCY_MEMORY_PRELOAD_SAMPLE_RATE
+                                      One in how many allocations is served from a
+                                      guarded mapping (see `fancy_memory_set_sample_rate`),
+                                      which makes overflows and use-after-free bugs fault.
+
+    Note that, like the rest of the library, the shim terminates the process when the
+    system runs out of memory, instead of returning the NULL pointer.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <dlfcn.h>
+
+#include "fancy_memory.h"
+
+// The C library's own allocator, which glibc exports under these names.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/*
+    The "initial-exec" model makes the flag part of the static TLS block, such that
+    accessing it never calls `__tls_get_addr` (which may allocate memory).
+*/
+static _Thread_local bool fancy_memory_preload_inside __attribute__((tls_model("initial-exec")));
+
+static fancy_memory_t *fancy_memory_preload_tracker = NULL;
+static pthread_once_t fancy_memory_preload_once = PTHREAD_ONCE_INIT;
+static volatile sig_atomic_t fancy_memory_preload_export_requested = 0;
+// glibc does not export its `malloc_usable_size` under another name, so it is looked up.
+static size_t (*fancy_memory_preload_libc_usable_size)(void *pointer) = NULL;
+
+static void fancy_memory_preload_init(void);
+static bool fancy_memory_preload_enter(void);
+static void fancy_memory_preload_leave(void);
+static void fancy_memory_preload_on_signal(int signal_number);
+static void fancy_memory_preload_export(void);
+static void fancy_memory_preload_at_exit(void) __attribute__((destructor));
+static void *fancy_memory_preload_aligned(size_t alignment, size_t size);
+static void fancy_memory_preload_fork_prepare(void);
+static void fancy_memory_preload_fork_finish(void);
+
+void *malloc(size_t size)
+{
+    if (!fancy_memory_preload_enter())
+    {
+        return __libc_malloc(size);
+    }
+    void *pointer = fancy_memory_malloc(fancy_memory_preload_tracker, size);
+    fancy_memory_preload_leave();
+    return pointer;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!fancy_memory_preload_enter())
+    {
+        return __libc_calloc(count, size);
+    }
+    void *pointer = fancy_memory_calloc(fancy_memory_preload_tracker, count, size);
+    fancy_memory_preload_leave();
+    return pointer;
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    if (pointer == NULL)
+    {
+        return malloc(size);
+    }
+    if (size == 0)
+    {
+        // Like glibc's `realloc`, this frees the memory.
+        free(pointer);
+        return NULL;
+    }
+    if (!fancy_memory_preload_enter())
+    {
+        return __libc_realloc(pointer, size);
+    }
+    void *new_pointer = fancy_memory_try_realloc(fancy_memory_preload_tracker, pointer, size);
+    fancy_memory_preload_leave();
+    return new_pointer != NULL ? new_pointer : __libc_realloc(pointer, size);
+}
+
+void *reallocarray(void *pointer, size_t count, size_t size)
+{
+    // glibc's own `reallocarray` calls `__libc_realloc` directly, which would bypass
+    // the tracker, so it needs to be interposed as well.
+    if (size != 0 && count > SIZE_MAX / size)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(pointer, count * size);
+}
+
+void free(void *pointer)
+{
+    if (pointer == NULL)
+    {
+        return;
+    }
+    if (!fancy_memory_preload_enter())
+    {
+        __libc_free(pointer);
+        return;
+    }
+    bool freed = fancy_memory_try_free(fancy_memory_preload_tracker, pointer);
+    fancy_memory_preload_leave();
+    if (!freed)
+    {
+        __libc_free(pointer);
+    }
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void *) != 0)
+    {
+        return EINVAL;
+    }
+    *pointer = fancy_memory_preload_aligned(alignment, size);
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return fancy_memory_preload_aligned(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return fancy_memory_preload_aligned((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    // Like glibc's, the size is rounded up to a whole number of (at least one) pages.
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page_size)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = size == 0 ? page_size : (size + page_size - 1) & ~(page_size - 1);
+    return fancy_memory_preload_aligned(page_size, size);
+}
+
+size_t malloc_usable_size(void *pointer)
+{
+    // Tracked blocks report their requested size, which is all that may be used (e.g.,
+    // sampled blocks end right at a guard page, and are not known to the C library).
+    if (pointer == NULL)
+    {
+        return 0;
+    }
+    size_t size;
+    if (fancy_memory_preload_enter())
+    {
+        bool tracked = fancy_memory_try_get_size(fancy_memory_preload_tracker, pointer, &size);
+        fancy_memory_preload_leave();
+        if (tracked)
+        {
+            return size;
+        }
+    }
+    return fancy_memory_preload_libc_usable_size != NULL ? fancy_memory_preload_libc_usable_size(pointer) : 0;
+}
+
+static void *fancy_memory_preload_aligned(size_t alignment, size_t size)
+{
+    if (!fancy_memory_preload_enter())
+    {
+        return __libc_memalign(alignment, size);
+    }
+    void *pointer = fancy_memory_aligned_alloc(fancy_memory_preload_tracker, alignment, size);
+    fancy_memory_preload_leave();
+    return pointer;
+}
+
+static void fancy_memory_preload_init(void)
+{
+    char const *shards = getenv("FANCY_MEMORY_PRELOAD_SHARDS");
+    fancy_memory_preload_tracker = fancy_memory_create_concurrent(shards == NULL ? 0 : strtoul(shards, NULL, 10));
+    // The object pointer is converted through memory, since ISO C has no cast from it.
+    *(void **)&fancy_memory_preload_libc_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+    pthread_atfork(fancy_memory_preload_fork_prepare, fancy_memory_preload_fork_finish, fancy_memory_preload_fork_finish);
+    char const *sample_rate = getenv("FANCY_MEMORY_PRELOAD_SAMPLE_RATE");
+    if (sample_rate != NULL)
+    {
+        fancy_memory_set_sample_rate(fancy_memory_preload_tracker, strtoul(sample_rate, NULL, 10));
+    }
+    char const *signal_number = getenv("FANCY_MEMORY_PRELOAD_SIGNAL");
+    if (signal_number != NULL)
+    {
+        struct sigaction action = {0};
+        action.sa_handler = fancy_memory_preload_on_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(atoi(signal_number), &action, NULL);
+    }
+}
+
+static bool fancy_memory_preload_enter(void)
+{
+    // Returns `false` if the call comes from the tracker itself (or from the pending
+    // export), in which case it must be served by the C library.
+    if (fancy_memory_preload_inside)
+    {
+        return false;
+    }
+    fancy_memory_preload_inside = true;
+    pthread_once(&fancy_memory_preload_once, fancy_memory_preload_init);
+    if (fancy_memory_preload_export_requested)
+    {
+        fancy_memory_preload_export_requested = 0;
+        fancy_memory_preload_export();
+    }
+    return true;
+}
+
+static void fancy_memory_preload_leave(void)
+{
+    fancy_memory_preload_inside = false;
+}
+
+static void fancy_memory_preload_on_signal(int signal_number)
+{
+    // Nothing that allocates (or locks) can be done from a signal handler, so the
+    // export is left to the next call.
+    (void)signal_number;
+    fancy_memory_preload_export_requested = 1;
+}
+
+static void fancy_memory_preload_export(void)
+{
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(fancy_memory_preload_tracker, &stats);
+    char const *path = getenv("FANCY_MEMORY_PRELOAD_OUTPUT");
+    FILE *stream = path == NULL ? stderr : fopen(path, "a");
+    if (stream != NULL)
+    {
+        fprintf(stream,
+                "{\"pid\":%ld,\"live_bytes\":%zu,\"live_count\":%zu,\"peak_bytes\":%zu,\"peak_count\":%zu,"
+                "\"allocation_count\":%" PRIu64 ",\"free_count\":%" PRIu64 ",\"reallocation_count\":%" PRIu64 "}\n",
+                (long)getpid(), stats.live_bytes, stats.live_count, stats.peak_bytes, stats.peak_count,
+                stats.allocation_count, stats.free_count, stats.reallocation_count);
+        if (stream != stderr)
+        {
+            fclose(stream);
+        }
+    }
+    path = getenv("FANCY_MEMORY_PRELOAD_SNAPSHOT");
+    stream = path == NULL ? NULL : fopen(path, "wb");
+    if (stream != NULL)
+    {
+        fancy_memory_snapshot_write(fancy_memory_preload_tracker, stream);
+        fclose(stream);
+    }
+}
+
+static void fancy_memory_preload_at_exit(void)
+{
+    // The tracker is never destroyed, since other destructors (or threads) may still
+    // free memory after this one has run.
+    if (fancy_memory_preload_tracker == NULL || fancy_memory_preload_inside)
+    {
+        return;
+    }
+    fancy_memory_preload_inside = true;
+    fancy_memory_preload_export();
+    fancy_memory_preload_inside = false;
+}
+
+static void fancy_memory_preload_fork_prepare(void)
+{
+    // The flag stays set until the fork is over, so that the forking thread never waits
+    // for a lock that it holds itself.
+    fancy_memory_preload_inside = true;
+    fancy_memory_lock_all(fancy_memory_preload_tracker);
+}
+
+static void fancy_memory_preload_fork_finish(void)
+{
+    // Called in both the parent and the child, in which the forking thread is the owner
+    // of the locks (and the only thread).
+    fancy_memory_unlock_all(fancy_memory_preload_tracker);
+    fancy_memory_preload_inside = false;
+}
@@ -25,11 +25,20 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <errno.h>
 
 #ifdef _WIN32
 #include <Windows.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #endif
 
 #include "fancy_memory.h"
@@ -40,13 +49,145 @@
 #define TOTAL_NUMBER_OF_ITERATIONS (100000)
 #define SLEEP_DURATION_IN_SECONDS (1)
 #define NUMBER_OF_ITERATIONS_BEFORE_SLEEP (1000)
+#define CHURN_NUMBER_OF_OPERATIONS (4000000)
+#define CHURN_MAX_LIVE_POINTERS (200000)
+#define CONCURRENT_NUMBER_OF_THREADS (8)
+#define CONCURRENT_NUMBER_OF_OPERATIONS (200000)
+#define CONCURRENT_MAX_LIVE_POINTERS (4096)
+
+typedef struct
+{
+    fancy_memory_t *m;
+    uint64_t seed;
+    char **live;
+    size_t n;
+    size_t total;
+} concurrent_worker_t;
 
 #if (RUN_INTEGRATION_TEST == 1)
 static void sleep_seconds(size_t n);
 #endif
+static uint64_t next_random(uint64_t *state);
+static void test_index_churn(void);
+static void test_index_drain(void);
+static void test_reserve(void);
+static void test_stats(void);
+static void test_pool_backend(void);
+static void test_arena_backend(void);
+static void test_reset(void);
+static void *concurrent_churn(void *argument);
+static void *concurrent_drain(void *argument);
+static void test_concurrent(void);
+static void test_header_backend(void);
+static void test_sites(fancy_memory_t *m);
+static void test_histograms(fancy_memory_t *m);
+static void test_snapshot(fancy_memory_t *m);
+static void test_batches(fancy_memory_t *m);
+static void test_aligned_and_large(fancy_memory_t *m, bool mapped);
+static void test_children(fancy_memory_t *root);
+static void test_try(fancy_memory_t *m);
+static void test_fork(fancy_memory_t *m);
+static void *remote_consumer(void *argument);
+static void test_remote_frees(fancy_memory_t *m);
+static bool count_block(fancy_memory_block_t const *block, void *context);
+static bool stop_after_five(fancy_memory_block_t const *block, void *context);
+static void test_foreach(fancy_memory_t *m);
+static void test_publish(fancy_memory_t *m);
+static void test_handles(fancy_memory_t *m);
+static void expect_fault(unsigned char volatile *pointer);
+static void test_sampling(fancy_memory_t *m);
+static void test_sampling_alternation(void);
+static void *retire_reader(void *argument);
+static void test_retire(fancy_memory_t *m);
+static void *retire_stats_poller(void *argument);
+static void test_retire_stats(void);
+static void test_retire_misuse(fancy_memory_t *m);
+static int run_tool(char const *tool, char const *argument, char const *output);
+static void test_retire_exports(fancy_memory_t *m);
+static void *concurrent_fill(void *argument);
+static void test_snapshot_concurrent(void);
+static void *realloc_stats_poller(void *argument);
+static void test_concurrent_peaks_and_reallocs(void);
 
 int main(void)
 {
+    test_index_churn();
+    test_index_drain();
+    test_reserve();
+    test_stats();
+    test_pool_backend();
+    test_arena_backend();
+    test_reset();
+    test_concurrent();
+    test_header_backend();
+    test_sites(fancy_memory_create());
+    test_sites(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_sites(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_sites(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_sites(fancy_memory_create_concurrent(4));
+    test_histograms(fancy_memory_create());
+    test_histograms(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_histograms(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_histograms(fancy_memory_create_concurrent(1));
+    test_snapshot(fancy_memory_create());
+    test_snapshot(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_snapshot(fancy_memory_create_concurrent(8));
+    test_batches(fancy_memory_create());
+    test_batches(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_batches(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_batches(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_batches(fancy_memory_create_concurrent(4));
+    test_aligned_and_large(fancy_memory_create(), true);
+    test_aligned_and_large(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL), true);
+    test_aligned_and_large(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA), false);
+    test_aligned_and_large(fancy_memory_create_concurrent(4), true);
+    test_children(fancy_memory_create());
+    test_children(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_children(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_children(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_try(fancy_memory_create());
+    test_try(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_try(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_try(fancy_memory_create_concurrent(4));
+    test_fork(fancy_memory_create_concurrent(4));
+    test_remote_frees(fancy_memory_create());
+    test_remote_frees(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_remote_frees(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_remote_frees(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_remote_frees(fancy_memory_create_concurrent(4));
+    test_foreach(fancy_memory_create());
+    test_foreach(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_foreach(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_foreach(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_foreach(fancy_memory_create_concurrent(4));
+    test_publish(fancy_memory_create());
+    test_publish(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_publish(fancy_memory_create_concurrent(4));
+    test_handles(fancy_memory_create());
+    test_handles(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_handles(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_handles(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_sampling(fancy_memory_create());
+    test_sampling(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_sampling(fancy_memory_create_concurrent(4));
+    test_sampling_alternation();
+    test_retire(fancy_memory_create());
+    test_retire(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_retire(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_retire(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_retire(fancy_memory_create_concurrent(4));
+    test_retire_stats();
+    test_retire_misuse(fancy_memory_create());
+    test_retire_misuse(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL));
+    test_retire_misuse(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_retire_misuse(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER));
+    test_retire_misuse(fancy_memory_create_concurrent(4));
+    test_retire_exports(fancy_memory_create());
+    test_retire_exports(fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_ARENA));
+    test_retire_exports(fancy_memory_create_concurrent(4));
+    test_snapshot_concurrent();
+    test_concurrent_peaks_and_reallocs();
+
     fancy_memory_t *m = fancy_memory_create();
     assert(m != NULL);
     assert(fancy_memory_get_total(m) == 0);
@@ -94,3 +235,1421 @@ static void sleep_seconds(size_t n)
 #endif
 }
 #endif
+
+static uint64_t next_random(uint64_t *state)
+{
+    // xorshift64*: deterministic, so that failures are reproducible.
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(2685821657736338717);
+}
+
+static void test_index_churn(void)
+{
+    // Millions of random allocations, reallocations and frees (in random order)
+    // while keeping up to CHURN_MAX_LIVE_POINTERS pointers alive, such that the
+    // address index goes through many incremental grow and shrink cycles.
+    fancy_memory_t *m = fancy_memory_create();
+    char **live = malloc(sizeof(char *) * CHURN_MAX_LIVE_POINTERS);
+    assert(live != NULL);
+    size_t n = 0;
+    size_t expected_total = 0;
+    size_t peak = CHURN_MAX_LIVE_POINTERS;
+    uint64_t state = UINT64_C(0x2545F4914F6CDD1D);
+
+    for (size_t i = 0; i < CHURN_NUMBER_OF_OPERATIONS; i++)
+    {
+        // Alternate between growing phases and draining phases.
+        if (i % (CHURN_NUMBER_OF_OPERATIONS / 8) == 0)
+        {
+            peak = (peak == CHURN_MAX_LIVE_POINTERS) ? 16 : CHURN_MAX_LIVE_POINTERS;
+        }
+        uint64_t r = next_random(&state);
+        size_t size = (size_t)(r >> 59) + 1;
+        if (n == 0 || (n < peak && (r & 3) != 0))
+        {
+            char *p = fancy_memory_malloc(m, size);
+            p[0] = (char)size;
+            live[n++] = p;
+            expected_total += size;
+        }
+        else
+        {
+            size_t index = (size_t)((r >> 8) % n);
+            char *p = live[index];
+            if ((r & 4) != 0)
+            {
+                expected_total -= (size_t)p[0];
+                p = fancy_memory_realloc(m, p, size);
+                p[0] = (char)size;
+                live[index] = p;
+                expected_total += size;
+            }
+            else
+            {
+                expected_total -= (size_t)p[0];
+                fancy_memory_free(m, p);
+                live[index] = live[--n];
+            }
+        }
+        assert(fancy_memory_get_total(m) == expected_total);
+    }
+
+    while (n > 0)
+    {
+        fancy_memory_free(m, live[--n]);
+    }
+    assert(fancy_memory_get_total(m) == 0);
+    free(live);
+    fancy_memory_destroy(m);
+}
+
+static void test_index_drain(void)
+{
+    // Draining a large tracker shrinks the index over and over. Each insertion and
+    // deletion migrates at most FANCY_MEMORY_INDEX_MIGRATION_STEP slots, and the
+    // library asserts that no resize ever has to finish a pending migration at once
+    // (i.e., that no single free pays for a full rehash).
+    size_t const n = (size_t)1 << 20;
+    fancy_memory_t *m = fancy_memory_create();
+    void **pointers = malloc(sizeof(void *) * n);
+    assert(pointers != NULL);
+    for (size_t i = 0; i < n; i++)
+    {
+        pointers[i] = fancy_memory_malloc(m, 8);
+    }
+    // Growing right after a shrink must not catch up with the shrink's migration either.
+    for (size_t round = 0; round < 3; round++)
+    {
+        for (size_t i = n / 16; i < n; i++)
+        {
+            fancy_memory_free(m, pointers[i]);
+        }
+        for (size_t i = n / 16; i < n; i++)
+        {
+            pointers[i] = fancy_memory_malloc(m, 8);
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        fancy_memory_free(m, pointers[i]);
+    }
+    assert(fancy_memory_get_total(m) == 0);
+    free(pointers);
+    fancy_memory_destroy(m);
+}
+
+static void test_reserve(void)
+{
+    fancy_memory_t *m = fancy_memory_create();
+    fancy_memory_reserve(m, 1000);
+    void *pointers[1000];
+    for (size_t i = 0; i < 1000; i++)
+    {
+        pointers[i] = fancy_memory_malloc(m, i);
+    }
+    assert(fancy_memory_get_total(m) == (999 * 1000) / 2);
+    // Free in FIFO order, so that every removal moves the last item.
+    for (size_t i = 0; i < 1000; i++)
+    {
+        fancy_memory_free(m, pointers[i]);
+    }
+    assert(fancy_memory_get_total(m) == 0);
+    fancy_memory_reserve(m, 0);
+    fancy_memory_destroy(m);
+}
+
+static void test_stats(void)
+{
+    fancy_memory_t *m = fancy_memory_create();
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_bytes == 0 && stats.live_count == 0);
+    assert(stats.peak_bytes == 0 && stats.peak_count == 0);
+
+    void *a = fancy_memory_malloc(m, 10);
+    void *b = fancy_memory_malloc(m, 20);
+    b = fancy_memory_realloc(m, b, 40);
+    fancy_memory_free(m, a);
+    void *c = fancy_memory_malloc(m, 5);
+
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_bytes == 45);
+    assert(stats.live_count == 2);
+    assert(stats.peak_bytes == 50);
+    assert(stats.peak_count == 2);
+    assert(stats.allocation_count == 3);
+    assert(stats.free_count == 1);
+    assert(stats.reallocation_count == 1);
+    assert(fancy_memory_get_total(m) == stats.live_bytes);
+
+    fancy_memory_free(m, b);
+    fancy_memory_free(m, c);
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_bytes == 0 && stats.live_count == 0);
+    assert(stats.peak_bytes == 50);
+    fancy_memory_destroy(m);
+}
+
+static void test_pool_backend(void)
+{
+    // Blocks are filled with a per-block byte pattern, which is checked before each
+    // free and reallocation, to make sure that pooled blocks never overlap.
+    enum
+    {
+        COUNT = 20000
+    };
+    fancy_memory_t *m = fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_POOL);
+    unsigned char **blocks = malloc(sizeof(unsigned char *) * COUNT);
+    size_t *sizes = malloc(sizeof(size_t) * COUNT);
+    assert(blocks != NULL && sizes != NULL);
+    uint64_t state = UINT64_C(0x9E3779B97F4A7C15);
+    size_t expected_total = 0;
+
+    for (size_t round = 0; round < 4; round++)
+    {
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            // Mostly small (pooled) sizes, with the occasional system allocation.
+            uint64_t r = next_random(&state);
+            sizes[i] = (r % 16 == 0) ? 257 + (size_t)(r >> 40) % 1024 : (size_t)(r >> 40) % 257;
+            blocks[i] = fancy_memory_malloc(m, sizes[i]);
+            memset(blocks[i], (int)(i & 0xFF), sizes[i]);
+            expected_total += sizes[i];
+        }
+        assert(fancy_memory_get_total(m) == expected_total);
+
+        for (size_t i = 0; i < COUNT; i += 3)
+        {
+            size_t new_size = (size_t)(next_random(&state) >> 40) % 400;
+            for (size_t j = 0; j < sizes[i]; j++)
+            {
+                assert(blocks[i][j] == (unsigned char)(i & 0xFF));
+            }
+            blocks[i] = fancy_memory_realloc(m, blocks[i], new_size);
+            for (size_t j = 0; j < (sizes[i] < new_size ? sizes[i] : new_size); j++)
+            {
+                assert(blocks[i][j] == (unsigned char)(i & 0xFF));
+            }
+            memset(blocks[i], (int)(i & 0xFF), new_size);
+            expected_total = expected_total - sizes[i] + new_size;
+            sizes[i] = new_size;
+        }
+        assert(fancy_memory_get_total(m) == expected_total);
+
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            size_t k = (i * 7919) % COUNT;
+            for (size_t j = 0; j < sizes[k]; j++)
+            {
+                assert(blocks[k][j] == (unsigned char)(k & 0xFF));
+            }
+            fancy_memory_free(m, blocks[k]);
+            expected_total -= sizes[k];
+        }
+        assert(fancy_memory_get_total(m) == 0);
+    }
+
+    // Pooled blocks that are still tracked are released along with the slabs.
+    fancy_memory_malloc(m, 8);
+    fancy_memory_malloc(m, 200);
+    free(sizes);
+    free(blocks);
+    fancy_memory_destroy(m);
+}
+
+static void test_arena_backend(void)
+{
+    fancy_memory_t *m = fancy_memory_create_arena(1024);
+    for (size_t request = 0; request < 100; request++)
+    {
+        char *a = fancy_memory_malloc(m, 100);
+        memset(a, 'a', 100);
+        char *b = fancy_memory_malloc(m, 200);
+        memset(b, 'b', 200);
+        assert(fancy_memory_get_total(m) == 300);
+        assert(((uintptr_t)a % 16) == 0 && ((uintptr_t)b % 16) == 0);
+
+        // The most recent block grows in place while the chunk has room...
+        char *grown = fancy_memory_realloc(m, b, 400);
+        assert(grown == b);
+        assert(fancy_memory_get_total(m) == 500);
+        // ...but moves (with its content) once it does not fit anymore.
+        char *moved = fancy_memory_realloc(m, grown, 4000);
+        assert(moved != grown);
+        for (size_t i = 0; i < 200; i++)
+        {
+            assert(moved[i] == 'b');
+        }
+        assert(fancy_memory_get_total(m) == 4100);
+        // Older blocks are reallocated by copying.
+        a = fancy_memory_realloc(m, a, 50);
+        for (size_t i = 0; i < 50; i++)
+        {
+            assert(a[i] == 'a');
+        }
+        assert(fancy_memory_get_total(m) == 4050);
+        fancy_memory_free(m, moved);
+        assert(fancy_memory_get_total(m) == 50);
+
+        for (size_t i = 0; i < 64; i++)
+        {
+            fancy_memory_malloc(m, i * 10);
+        }
+        fancy_memory_reset(m);
+        assert(fancy_memory_get_total(m) == 0);
+    }
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_count == 0);
+    assert(stats.allocation_count == 100 * 66);
+    assert(stats.free_count == 100 * 66);
+    assert(stats.reallocation_count == 100 * 3);
+
+    // A batch that does not fit in the current chunk is carved out of a single run.
+    size_t sizes[100];
+    void *pointers[100];
+    for (size_t i = 0; i < 100; i++)
+    {
+        sizes[i] = 20;
+    }
+    fancy_memory_malloc(m, 1000);
+    fancy_memory_malloc_many(m, sizes, 100, pointers);
+    for (size_t i = 1; i < 100; i++)
+    {
+        assert((char *)pointers[i] > (char *)pointers[i - 1] && (char *)pointers[i] - (char *)pointers[i - 1] < 128);
+    }
+    fancy_memory_reset(m);
+    fancy_memory_destroy(m);
+}
+
+static void test_reset(void)
+{
+    fancy_memory_backend_t backends[] = {FANCY_MEMORY_BACKEND_SYSTEM, FANCY_MEMORY_BACKEND_POOL};
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        fancy_memory_t *m = fancy_memory_create_with_backend(backends[b]);
+        for (size_t round = 0; round < 3; round++)
+        {
+            for (size_t i = 0; i < 100; i++)
+            {
+                fancy_memory_malloc(m, i * 5);
+            }
+            assert(fancy_memory_get_total(m) == 5 * (99 * 100) / 2);
+            fancy_memory_reset(m);
+            assert(fancy_memory_get_total(m) == 0);
+            // Blocks allocated after a reset are tracked normally.
+            void *p = fancy_memory_malloc(m, 10);
+            fancy_memory_free(m, p);
+        }
+        fancy_memory_destroy(m);
+    }
+}
+
+static void *concurrent_churn(void *argument)
+{
+    concurrent_worker_t *worker = argument;
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_OPERATIONS; i++)
+    {
+        uint64_t r = next_random(&worker->seed);
+        size_t size = (size_t)(r >> 58) + 1;
+        if (worker->n == 0 || (worker->n < CONCURRENT_MAX_LIVE_POINTERS && (r & 1) != 0))
+        {
+            char *p = fancy_memory_malloc(worker->m, size);
+            p[0] = (char)size;
+            worker->live[worker->n++] = p;
+            worker->total += size;
+        }
+        else
+        {
+            size_t index = (size_t)((r >> 8) % worker->n);
+            char *p = worker->live[index];
+            worker->total -= (size_t)p[0];
+            if ((r & 2) != 0)
+            {
+                p = fancy_memory_realloc(worker->m, p, size);
+                p[0] = (char)size;
+                worker->live[index] = p;
+                worker->total += size;
+            }
+            else
+            {
+                fancy_memory_free(worker->m, p);
+                worker->live[index] = worker->live[--worker->n];
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *concurrent_drain(void *argument)
+{
+    concurrent_worker_t *worker = argument;
+    while (worker->n > 0)
+    {
+        fancy_memory_free(worker->m, worker->live[--worker->n]);
+    }
+    return NULL;
+}
+
+static void test_concurrent(void)
+{
+    fancy_memory_t *m = fancy_memory_create_concurrent(0);
+    concurrent_worker_t workers[CONCURRENT_NUMBER_OF_THREADS];
+    pthread_t threads[CONCURRENT_NUMBER_OF_THREADS];
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        workers[i] = (concurrent_worker_t){.m = m, .seed = UINT64_C(0x9E3779B97F4A7C15) * (i + 1)};
+        workers[i].live = malloc(sizeof(char *) * CONCURRENT_MAX_LIVE_POINTERS);
+        assert(workers[i].live != NULL);
+        assert(pthread_create(&threads[i], NULL, concurrent_churn, &workers[i]) == 0);
+    }
+    size_t expected_total = 0;
+    size_t expected_count = 0;
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        assert(pthread_join(threads[i], NULL) == 0);
+        expected_total += workers[i].total;
+        expected_count += workers[i].n;
+    }
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_bytes == expected_total);
+    assert(stats.live_count == expected_count);
+    assert(stats.allocation_count - stats.free_count == expected_count);
+    assert(stats.peak_bytes >= expected_total);
+
+    // Every thread now frees the pointers that were allocated by another thread.
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        concurrent_worker_t *previous = &workers[(i + CONCURRENT_NUMBER_OF_THREADS - 1) % CONCURRENT_NUMBER_OF_THREADS];
+        assert(pthread_create(&threads[i], NULL, concurrent_drain, previous) == 0);
+    }
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        free(workers[i].live);
+    }
+    assert(fancy_memory_get_total(m) == 0);
+    fancy_memory_destroy(m);
+}
+
+static void test_header_backend(void)
+{
+    fancy_memory_t *m = fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER);
+    char *a = fancy_memory_malloc(m, 10);
+    char *b = fancy_memory_malloc(m, 20);
+    char *c = fancy_memory_malloc(m, 30);
+    assert(((uintptr_t)a % 16) == 0);
+    strcpy(b, "hello");
+    assert(fancy_memory_get_total(m) == 60);
+
+    // Reallocating the middle block must keep the intrusive list consistent.
+    b = fancy_memory_realloc(m, b, 100000);
+    assert(strcmp(b, "hello") == 0);
+    assert(fancy_memory_get_total(m) == 100040);
+
+    FILE *stream = tmpfile();
+    assert(stream != NULL);
+    fancy_memory_debug(m, stream);
+    assert(ftell(stream) > 0);
+    fclose(stream);
+
+    fancy_memory_free(m, a);
+    fancy_memory_free(m, c);
+    assert(fancy_memory_get_total(m) == 100000);
+    fancy_memory_free(m, b);
+    assert(fancy_memory_get_total(m) == 0);
+
+    for (size_t i = 0; i < 1000; i++)
+    {
+        fancy_memory_malloc(m, i);
+    }
+    fancy_memory_reset(m);
+    assert(fancy_memory_get_total(m) == 0);
+    fancy_memory_destroy(m);
+}
+
+static void test_sites(fancy_memory_t *m)
+{
+    void *small[100];
+    void *large[10];
+    for (size_t i = 0; i < 100; i++)
+    {
+        small[i] = FANCY_MEMORY_MALLOC(m, 8);
+    }
+    for (size_t i = 0; i < 10; i++)
+    {
+        large[i] = FANCY_MEMORY_MALLOC(m, 1000);
+    }
+    void *untracked = fancy_memory_malloc(m, 50000);
+
+    fancy_memory_site_stats_t sites[4];
+    assert(fancy_memory_get_top_sites(m, sites, 4) == 2);
+    assert(sites[0].live_bytes == 10000 && sites[0].live_count == 10);
+    assert(sites[1].live_bytes == 800 && sites[1].allocation_count == 100);
+    assert(strcmp(sites[0].function, "test_sites") == 0);
+    assert(sites[0].line == sites[1].line + 4);
+
+    // Plain reallocations keep the site, while site-aware ones move the block.
+    large[0] = fancy_memory_realloc(m, large[0], 2000);
+    small[0] = FANCY_MEMORY_REALLOC(m, small[0], 5000);
+    assert(fancy_memory_get_top_sites(m, sites, 1) == 1);
+    assert(sites[0].live_bytes == 11000 && sites[0].allocated_bytes == 11000);
+    assert(fancy_memory_get_top_sites(m, sites, 4) == 3);
+    assert(sites[1].live_bytes == 5000 && sites[1].live_count == 1);
+    assert(sites[2].live_bytes == 792 && sites[2].live_count == 99);
+
+    for (size_t i = 0; i < 100; i++)
+    {
+        fancy_memory_free(m, small[i]);
+    }
+    fancy_memory_free(m, untracked);
+    assert(fancy_memory_get_top_sites(m, sites, 4) == 3);
+    assert(sites[0].live_bytes == 11000 && sites[1].live_bytes == 0 && sites[2].live_count == 0);
+    assert(sites[2].allocation_count == 100);
+
+    fancy_memory_reset(m);
+    assert(fancy_memory_get_top_sites(m, sites, 4) == 3);
+    assert(sites[0].live_bytes == 0 && sites[0].allocation_count == 10);
+    fancy_memory_destroy(m);
+}
+
+static void test_histograms(fancy_memory_t *m)
+{
+    void *a = fancy_memory_malloc(m, 0);
+    void *b = fancy_memory_malloc(m, 1);
+    void *c = fancy_memory_malloc(m, 100);
+    c = fancy_memory_realloc(m, c, 4096);
+    fancy_memory_free(m, b);
+    fancy_memory_free(m, c);
+    fancy_memory_free(m, a);
+
+    fancy_memory_histograms_t histograms;
+    fancy_memory_get_histograms(m, &histograms);
+    assert(histograms.sizes[0] == 1 && histograms.sizes[1] == 1);
+    assert(histograms.sizes[7] == 1 && histograms.sizes[13] == 1);
+    // Lifetimes (in operations): b = 3 (i.e., [2 .. 3]), c = 3, and a = 6 (i.e., [4 .. 7]).
+    assert(histograms.lifetimes[2] == 2 && histograms.lifetimes[3] == 1);
+
+    FILE *stream = tmpfile();
+    assert(stream != NULL);
+    fancy_memory_debug(m, stream);
+    rewind(stream);
+    char line[256];
+    bool found = false;
+    while (fgets(line, sizeof(line), stream) != NULL)
+    {
+        found = found || strcmp(line, "\t.[4096 .. 8191] = 1,\n") == 0;
+    }
+    assert(found);
+    fclose(stream);
+    fancy_memory_destroy(m);
+}
+
+static void test_snapshot(fancy_memory_t *m)
+{
+    // Enough entries for the snapshot to span several flushes of the internal buffer.
+    size_t n = 100000;
+    void **pointers = malloc(sizeof(void *) * n);
+    assert(pointers != NULL);
+    for (size_t i = 0; i < n; i++)
+    {
+        pointers[i] = i % 2 == 0 ? FANCY_MEMORY_MALLOC(m, 24) : fancy_memory_malloc(m, i % 7);
+    }
+    FILE *stream = tmpfile();
+    assert(stream != NULL);
+    assert(fancy_memory_snapshot_write(m, stream));
+
+    // The entries are at the end of the snapshot, in blocks (each preceded by its count),
+    // the last of which is empty.
+    rewind(stream);
+    unsigned char header[32];
+    assert(fread(header, 1, sizeof(header), stream) == sizeof(header));
+    assert(memcmp(header, "FANCYMEM", 8) == 0 && header[8] == 1);
+    assert(fseek(stream, -8, SEEK_END) == 0);
+    unsigned char last[8] = {1};
+    assert(fread(last, 1, 8, stream) == 8);
+    for (size_t i = 0; i < 8; i++)
+    {
+        assert(last[i] == 0);
+    }
+    // Everything before the entries takes less than 64 KiB here.
+    long size = ftell(stream);
+    assert(size > (long)(n * 16) && size < (long)(n * 16 + 65536));
+    fclose(stream);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        fancy_memory_free(m, pointers[i]);
+    }
+    free(pointers);
+    fancy_memory_destroy(m);
+}
+
+static void test_batches(fancy_memory_t *m)
+{
+    size_t sizes[5000];
+    void *pointers[5000];
+    size_t total = 0;
+    for (size_t i = 0; i < 5000; i++)
+    {
+        sizes[i] = i % 3 == 0 ? 48 : (i % 300) + 1;
+        total += sizes[i];
+    }
+    void *single = fancy_memory_malloc(m, 7);
+    for (size_t round = 0; round < 3; round++)
+    {
+        fancy_memory_malloc_many(m, sizes, 5000, pointers);
+        assert(fancy_memory_get_total(m) == total + 7);
+        for (size_t i = 0; i < 5000; i++)
+        {
+            memset(pointers[i], (int)i, sizes[i]);
+        }
+        // Blocks from a batch can be freed individually, and vice versa.
+        fancy_memory_free(m, pointers[4999]);
+        void *extra = fancy_memory_malloc(m, sizes[4999]);
+        pointers[4999] = extra;
+        fancy_memory_free_many(m, pointers, 5000);
+        assert(fancy_memory_get_total(m) == 7);
+    }
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_count == 1 && stats.allocation_count == 1 + 3 * 5001);
+    assert(stats.free_count == 3 * 5001 && stats.peak_bytes >= total + 7);
+    fancy_memory_free_many(m, &single, 1);
+    fancy_memory_free_many(m, NULL, 0);
+    assert(fancy_memory_get_total(m) == 0);
+    fancy_memory_destroy(m);
+}
+
+static void test_aligned_and_large(fancy_memory_t *m, bool mapped)
+{
+    fancy_memory_set_large_threshold(m, 1024 * 1024);
+    void *small[16];
+    for (size_t i = 0; i < 16; i++)
+    {
+        size_t alignment = (size_t)1 << (i % 13);
+        small[i] = fancy_memory_aligned_alloc(m, alignment, 10 + i * 20);
+        assert(((uintptr_t)small[i] % alignment) == 0);
+        memset(small[i], 0xAB, 10 + i * 20);
+    }
+    unsigned char *zeroed = fancy_memory_calloc(m, 100, 3);
+    for (size_t i = 0; i < 300; i++)
+    {
+        assert(zeroed[i] == 0);
+    }
+
+    // Large blocks are zero-filled, page aligned, and may cross the threshold both ways.
+    size_t large_size = 3 * 1024 * 1024;
+    unsigned char *large = fancy_memory_calloc(m, large_size, 1);
+    assert(!mapped || ((uintptr_t)large % 4096) == 0);
+    assert(large[0] == 0 && large[large_size - 1] == 0);
+    memset(large, 7, large_size);
+    large = fancy_memory_realloc(m, large, 2 * large_size);
+    assert(large[large_size - 1] == 7);
+    large = fancy_memory_realloc(m, large, 100);
+    assert(large[99] == 7);
+    large = fancy_memory_realloc(m, large, 2 * 1024 * 1024);
+    assert(large[99] == 7);
+    void *buffer = fancy_memory_aligned_alloc(m, 64, 8 * 1024 * 1024);
+    assert(((uintptr_t)buffer % (mapped ? 2 * 1024 * 1024 : 64)) == 0);
+    assert(fancy_memory_get_total(m) == 2 * 1024 * 1024 + 8 * 1024 * 1024 + 300 + 16 * 10 + 20 * (15 * 16) / 2);
+
+    for (size_t i = 0; i < 16; i++)
+    {
+        small[i] = fancy_memory_realloc(m, small[i], 2000);
+        assert(((unsigned char *)small[i])[9] == 0xAB);
+    }
+    fancy_memory_free(m, buffer);
+    fancy_memory_free(m, large);
+    fancy_memory_free(m, zeroed);
+    for (size_t i = 0; i < 16; i++)
+    {
+        fancy_memory_free(m, small[i]);
+    }
+    assert(fancy_memory_get_total(m) == 0);
+    buffer = fancy_memory_aligned_alloc(m, 4096, 4 * 1024 * 1024);
+    fancy_memory_reset(m);
+    assert(fancy_memory_get_total(m) == 0);
+    fancy_memory_destroy(m);
+}
+
+static void test_children(fancy_memory_t *root)
+{
+    fancy_memory_t *connection = fancy_memory_create_child(root);
+    fancy_memory_t *requests[3];
+    for (size_t i = 0; i < 3; i++)
+    {
+        requests[i] = fancy_memory_create_child(connection);
+    }
+    void *global = fancy_memory_malloc(root, 1000);
+    void *buffer = fancy_memory_malloc(connection, 200);
+    for (size_t i = 0; i < 3; i++)
+    {
+        for (size_t j = 0; j < 100; j++)
+        {
+            memset(fancy_memory_malloc(requests[i], 10 + j), 0, 10 + j);
+        }
+    }
+    // Each request holds 100 * 10 + (99 * 100) / 2 = 5950 bytes.
+    assert(fancy_memory_get_total(requests[1]) == 5950);
+    assert(fancy_memory_get_total(connection) == 200 + 3 * 5950);
+    assert(fancy_memory_get_total(root) == 1000 + 200 + 3 * 5950);
+    buffer = fancy_memory_realloc(connection, buffer, 300);
+    assert(fancy_memory_get_total(root) == 1000 + 300 + 3 * 5950);
+
+    // Releasing a request's subtree only affects its ancestors' live totals.
+    fancy_memory_reset_tree(requests[0]);
+    assert(fancy_memory_get_total(connection) == 300 + 2 * 5950);
+    fancy_memory_destroy_tree(requests[1]);
+    assert(fancy_memory_get_total(root) == 1000 + 300 + 5950);
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(root, &stats);
+    assert(stats.live_count == 2 + 100 && stats.allocation_count == 2 + 300);
+    assert(stats.free_count == 200 && stats.reallocation_count == 1);
+    assert(stats.peak_bytes == 1000 + 300 + 3 * 5950 && stats.peak_count == 302);
+    fancy_memory_get_stats(connection, &stats);
+    assert(stats.live_bytes == 300 + 5950 && stats.peak_count == 301);
+
+    // Destroying a child without freeing its blocks (which are leaked here) detaches
+    // them from the totals.
+    fancy_memory_reset(requests[2]);
+    (void)fancy_memory_malloc(requests[2], 64);
+    fancy_memory_destroy(requests[2]);
+    assert(fancy_memory_get_total(root) == 1000 + 300);
+    fancy_memory_free(root, global);
+    fancy_memory_reset_tree(root);
+    assert(fancy_memory_get_total(root) == 0 && fancy_memory_get_total(connection) == 0);
+    fancy_memory_get_stats(root, &stats);
+    assert(stats.live_count == 0 && stats.allocation_count == 2 + 301 && stats.free_count == 2 + 300);
+    fancy_memory_destroy_tree(root);
+}
+
+static void test_try(fancy_memory_t *m)
+{
+    // Blocks owned by another tracker are left alone (they are header-prefixed, so that
+    // the header backends can safely read in front of them).
+    fancy_memory_t *other = fancy_memory_create_with_backend(FANCY_MEMORY_BACKEND_HEADER);
+    char *foreign = fancy_memory_malloc(other, 32);
+    char *own = fancy_memory_malloc(m, 32);
+    assert(!fancy_memory_try_free(m, foreign));
+    assert(fancy_memory_try_realloc(m, foreign, 64) == NULL);
+    assert(fancy_memory_get_total(m) == 32 && fancy_memory_get_total(other) == 32);
+    size_t size = 0;
+    assert(!fancy_memory_try_get_size(m, foreign, &size));
+    assert(fancy_memory_try_get_size(m, own, &size) && size == 32);
+    own = fancy_memory_try_realloc(m, own, 64);
+    assert(own != NULL && fancy_memory_get_total(m) == 64);
+    assert(fancy_memory_try_get_size(m, own, &size) && size == 64);
+    assert(fancy_memory_try_free(m, own));
+    assert(fancy_memory_try_free(other, foreign));
+    assert(fancy_memory_get_total(m) == 0 && fancy_memory_get_total(other) == 0);
+    fancy_memory_destroy(other);
+    fancy_memory_destroy(m);
+}
+
+static void test_fork(fancy_memory_t *m)
+{
+    // A worker keeps the (concurrent) tracker busy while the main thread forks, such that,
+    // without the locks being held across the fork, the child would sometimes inherit a
+    // lock that no thread of its own can release.
+    concurrent_worker_t worker = {.m = m, .seed = UINT64_C(0x2545F4914F6CDD1D)};
+    worker.live = malloc(sizeof(char *) * CONCURRENT_MAX_LIVE_POINTERS);
+    assert(worker.live != NULL);
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, concurrent_churn, &worker) == 0);
+    for (size_t i = 0; i < 20; i++)
+    {
+        fancy_memory_lock_all(m);
+        pid_t pid = fork();
+        fancy_memory_unlock_all(m);
+        if (pid == 0)
+        {
+            fancy_memory_stats_t stats;
+            fancy_memory_get_stats(m, &stats);
+            fancy_memory_free(m, fancy_memory_malloc(m, 16));
+            _exit(EXIT_SUCCESS);
+        }
+        int status;
+        assert(pid > 0 && waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    }
+    assert(pthread_join(thread, NULL) == 0);
+    assert(fancy_memory_get_total(m) == worker.total);
+    concurrent_drain(&worker);
+    free(worker.live);
+    assert(fancy_memory_get_total(m) == 0);
+    fancy_memory_destroy(m);
+}
+
+static void *remote_consumer(void *argument)
+{
+    concurrent_worker_t *worker = argument;
+    for (size_t i = 0; i < worker->n; i++)
+    {
+        assert(worker->live[i][0] == (char)i);
+        fancy_memory_free_remote(worker->m, worker->live[i]);
+    }
+    return NULL;
+}
+
+static void test_remote_frees(fancy_memory_t *m)
+{
+    // The main thread (i.e., the producer) keeps allocating, and thereby draining the
+    // queue, while the consumers free their messages remotely.
+    size_t n = 20000;
+    pthread_t threads[CONCURRENT_NUMBER_OF_THREADS];
+    concurrent_worker_t workers[CONCURRENT_NUMBER_OF_THREADS];
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        workers[i] = (concurrent_worker_t){.m = m, .live = malloc(sizeof(char *) * n), .n = n};
+        assert(workers[i].live != NULL);
+        for (size_t j = 0; j < n; j++)
+        {
+            workers[i].live[j] = fancy_memory_malloc(m, 8 + j % 40);
+            workers[i].live[j][0] = (char)j;
+        }
+    }
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        assert(pthread_create(&threads[i], NULL, remote_consumer, &workers[i]) == 0);
+    }
+    void *own[64];
+    for (size_t round = 0; round < 200; round++)
+    {
+        for (size_t j = 0; j < 64; j++)
+        {
+            own[j] = fancy_memory_malloc(m, 16);
+        }
+        for (size_t j = 0; j < 64; j++)
+        {
+            fancy_memory_free(m, own[j]);
+        }
+    }
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        assert(pthread_join(threads[i], NULL) == 0);
+        free(workers[i].live);
+    }
+    fancy_memory_collect(m);
+    assert(fancy_memory_collect(m) == 0);
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_bytes == 0 && stats.live_count == 0);
+    assert(stats.free_count == CONCURRENT_NUMBER_OF_THREADS * n + 200 * 64);
+
+    // Pending remote frees are honoured by a reset.
+    void *pending = fancy_memory_malloc(m, 100);
+    fancy_memory_free_remote(m, pending);
+    fancy_memory_reset(m);
+    assert(fancy_memory_get_total(m) == 0 && fancy_memory_collect(m) == 0);
+    fancy_memory_destroy(m);
+}
+
+static bool count_block(fancy_memory_block_t const *block, void *context)
+{
+    *(size_t *)context += block->size;
+    return true;
+}
+
+static bool stop_after_five(fancy_memory_block_t const *block, void *context)
+{
+    (void)block;
+    return ++*(size_t *)context < 5;
+}
+
+static void test_foreach(fancy_memory_t *m)
+{
+    // Blocks of 1 to 100 bytes, the last of which is attributed to a site.
+    for (size_t i = 1; i < 100; i++)
+    {
+        fancy_memory_malloc(m, i);
+    }
+    void *last = FANCY_MEMORY_MALLOC(m, 100);
+    size_t total = 0;
+    assert(fancy_memory_foreach(m, count_block, &total) == 100);
+    assert(total == 5050);
+    total = 0;
+    assert(fancy_memory_foreach_in_range(m, 10, 19, count_block, &total) == 10);
+    assert(total == 145);
+    size_t visited = 0;
+    assert(fancy_memory_foreach(m, stop_after_five, &visited) == 5 && visited == 5);
+
+    fancy_memory_iterator_t iterator;
+    fancy_memory_block_t block;
+    fancy_memory_iterator_init(&iterator, m, 100, SIZE_MAX);
+    assert(fancy_memory_iterator_next(&iterator, &block));
+    assert(block.address == last && block.size == 100);
+    assert(block.site != NULL && block.site->live_bytes == 100);
+    assert(!fancy_memory_iterator_next(&iterator, &block));
+    assert(!fancy_memory_iterator_next(&iterator, &block));
+
+    // A full walk returns every block exactly once.
+    size_t count = 0;
+    fancy_memory_iterator_init(&iterator, m, 0, SIZE_MAX);
+    while (fancy_memory_iterator_next(&iterator, &block))
+    {
+        assert(block.size >= 1 && block.size <= 100);
+        count++;
+    }
+    assert(count == 100);
+    fancy_memory_reset(m);
+    fancy_memory_iterator_init(&iterator, m, 0, SIZE_MAX);
+    assert(!fancy_memory_iterator_next(&iterator, &block));
+    assert(fancy_memory_foreach(m, count_block, &total) == 0);
+    fancy_memory_destroy(m);
+}
+
+static void test_publish(fancy_memory_t *m)
+{
+    // Publishing neither changes the tracker's behaviour, nor survives the tracker.
+    char name[64];
+    snprintf(name, sizeof(name), "/fancy_memory_test_%ld", (long)getpid());
+    fancy_memory_malloc(m, 24);
+    assert(fancy_memory_publish(m, name));
+    void *pointers[16];
+    for (size_t i = 0; i < 16; i++)
+    {
+        pointers[i] = fancy_memory_malloc(m, 100 + i);
+    }
+    for (size_t i = 0; i < 8; i++)
+    {
+        fancy_memory_free(m, pointers[i]);
+    }
+    pointers[8] = fancy_memory_realloc(m, pointers[8], 4096);
+    assert(fancy_memory_get_total(m) == 24 + 4096 + 109 + 110 + 111 + 112 + 113 + 114 + 115);
+
+    int descriptor = shm_open(name, O_RDONLY, 0);
+    assert(descriptor != -1);
+    char magic[8];
+    assert(read(descriptor, magic, sizeof(magic)) == sizeof(magic));
+    assert(memcmp(magic, "FANCYSHM", sizeof(magic)) == 0);
+    close(descriptor);
+
+    // A name that is already taken (e.g., by another process) is left alone.
+    fancy_memory_t *other = fancy_memory_create();
+    errno = 0;
+    assert(!fancy_memory_publish(other, name) && errno == EEXIST);
+    fancy_memory_destroy(other);
+    descriptor = shm_open(name, O_RDONLY, 0);
+    assert(descriptor != -1);
+    close(descriptor);
+
+    // Publishing again (e.g., after a reset) replaces the tracker's own object.
+    fancy_memory_reset(m);
+    assert(fancy_memory_publish(m, name));
+    fancy_memory_unpublish(m);
+    assert(shm_open(name, O_RDONLY, 0) == -1);
+    assert(fancy_memory_publish(m, name));
+    fancy_memory_destroy(m);
+    assert(shm_open(name, O_RDONLY, 0) == -1);
+}
+
+static void test_handles(fancy_memory_t *m)
+{
+    // Enough blocks to fill a few regions, three quarters of which are then freed (which
+    // leaves every region sparse), while the first one stays pinned.
+    size_t const count = 16384;
+    size_t const size = 200;
+    fancy_memory_handle_t *handles = malloc(sizeof(fancy_memory_handle_t) * count);
+    assert(handles != NULL);
+    fancy_memory_malloc(m, 10);
+    for (size_t i = 0; i < count; i++)
+    {
+        handles[i] = fancy_memory_handle_alloc(m, size);
+        assert(handles[i] != 0);
+        unsigned char *pointer = fancy_memory_pin(m, handles[i]);
+        assert(((uintptr_t)pointer % 16) == 0);
+        memset(pointer, (unsigned char)i, size);
+        fancy_memory_unpin(m, handles[i]);
+    }
+    assert(fancy_memory_get_total(m) == 10 + count * size);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i % 4 != 0)
+        {
+            fancy_memory_handle_free(m, handles[i]);
+        }
+    }
+    void *pinned = fancy_memory_pin(m, handles[0]);
+    void *before = fancy_memory_pin(m, handles[4]);
+    fancy_memory_unpin(m, handles[4]);
+
+    // A budget of 0 stops after the first few blocks.
+    assert(!fancy_memory_compact(m, 0));
+    while (!fancy_memory_compact(m, 1000000))
+    {
+    }
+    assert(fancy_memory_pin(m, handles[0]) == pinned);
+    fancy_memory_unpin(m, handles[0]);
+    fancy_memory_unpin(m, handles[0]);
+    assert(fancy_memory_pin(m, handles[4]) != before);
+    fancy_memory_unpin(m, handles[4]);
+    for (size_t i = 0; i < count; i += 4)
+    {
+        unsigned char const *pointer = fancy_memory_pin(m, handles[i]);
+        for (size_t j = 0; j < size; j++)
+        {
+            assert(pointer[j] == (unsigned char)i);
+        }
+        fancy_memory_unpin(m, handles[i]);
+    }
+    assert(fancy_memory_get_total(m) == 10 + count / 4 * size);
+    size_t total = 0;
+    assert(fancy_memory_foreach(m, count_block, &total) == 1 + count / 4);
+    assert(total == 10 + count / 4 * size);
+
+    // Freed handles are never reused as is, even if their record is.
+    for (size_t i = 0; i < count; i += 8)
+    {
+        fancy_memory_handle_free(m, handles[i]);
+        fancy_memory_handle_t handle = fancy_memory_handle_alloc(m, 0);
+        assert(handle != handles[i]);
+        fancy_memory_handle_free(m, handle);
+    }
+    assert(fancy_memory_get_total(m) == 10 + count / 8 * size);
+    fancy_memory_reset(m);
+    assert(fancy_memory_get_total(m) == 0);
+    handles[0] = fancy_memory_handle_alloc(m, 64);
+    fancy_memory_destroy(m);
+    free(handles);
+}
+
+static void expect_fault(unsigned char volatile *pointer)
+{
+    // The access happens in a child process, which must be killed by `SIGSEGV`.
+    fflush(stdout);
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0)
+    {
+        // Sanitizers install their own handler, which would turn the fault into an abort.
+        signal(SIGSEGV, SIG_DFL);
+        *pointer = 1;
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+}
+
+static void test_sampling(fancy_memory_t *m)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    fancy_memory_set_sample_rate(m, 1);
+    unsigned char *pointer = fancy_memory_malloc(m, 32);
+    assert(((uintptr_t)(pointer + 32) % page_size) == 0);
+    memset(pointer, 1, 32);
+    expect_fault(pointer + 32);
+
+    // Reallocated blocks stay guarded, and their old address is quarantined.
+    unsigned char *new_pointer = fancy_memory_realloc(m, pointer, 48);
+    assert(new_pointer != pointer && new_pointer[31] == 1);
+    assert(((uintptr_t)(new_pointer + 48) % page_size) == 0);
+    expect_fault(pointer);
+    fancy_memory_free(m, new_pointer);
+    expect_fault(new_pointer);
+    assert(fancy_memory_get_total(m) == 0);
+
+    // More frees than the quarantine holds (the oldest blocks are unmapped).
+    void *pointers[100];
+    for (size_t i = 0; i < 100; i++)
+    {
+        pointers[i] = fancy_memory_calloc(m, 1, i);
+    }
+    assert(fancy_memory_get_total(m) == 99 * 100 / 2);
+    for (size_t i = 0; i < 100; i++)
+    {
+        fancy_memory_free(m, pointers[i]);
+    }
+
+    // Every third allocation is sampled (i.e., ends at a page boundary), from a point of
+    // the countdown that is only fixed for non-concurrent trackers (and some unsampled
+    // pool blocks may end at a page boundary as well).
+    fancy_memory_set_sample_rate(m, 3);
+    size_t sampled = 0;
+    for (size_t i = 0; i < 30; i++)
+    {
+        pointers[i] = fancy_memory_malloc(m, 64);
+        sampled += ((uintptr_t)pointers[i] + 64) % page_size == 0 ? 1 : 0;
+    }
+    assert(sampled >= 10 && sampled < 20);
+    fancy_memory_set_sample_rate(m, 0);
+    pointer = fancy_memory_malloc(m, 64);
+    fancy_memory_free(m, pointer);
+    fancy_memory_reset(m);
+    assert(fancy_memory_get_total(m) == 0);
+    fancy_memory_destroy(m);
+}
+
+static void test_sampling_alternation(void)
+{
+    // A thread alternating between two concurrent trackers samples from both of them
+    // (a countdown shared by all the trackers would only ever sample from the second).
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    fancy_memory_t *trackers[2] = {fancy_memory_create_concurrent(4), fancy_memory_create_concurrent(4)};
+    void *pointers[2][100];
+    size_t sampled[2] = {0, 0};
+    for (size_t t = 0; t < 2; t++)
+    {
+        fancy_memory_set_sample_rate(trackers[t], 2);
+    }
+    for (size_t i = 0; i < 100; i++)
+    {
+        for (size_t t = 0; t < 2; t++)
+        {
+            pointers[t][i] = fancy_memory_malloc(trackers[t], 64);
+            sampled[t] += ((uintptr_t)pointers[t][i] + 64) % page_size == 0 ? 1 : 0;
+        }
+    }
+    for (size_t t = 0; t < 2; t++)
+    {
+        assert(sampled[t] >= 25 && sampled[t] <= 75);
+        for (size_t i = 0; i < 100; i++)
+        {
+            fancy_memory_free(trackers[t], pointers[t][i]);
+        }
+        fancy_memory_destroy(trackers[t]);
+    }
+}
+
+typedef struct
+{
+    fancy_memory_t *m;
+    size_t *_Atomic current;
+    _Atomic(bool) done;
+} retire_shared_t;
+
+static void *retire_reader(void *argument)
+{
+    // Every block holds its own index in each of its words, which a premature free
+    // (i.e., a reuse of the block) would overwrite.
+    retire_shared_t *shared = argument;
+    while (!atomic_load(&shared->done))
+    {
+        fancy_memory_read_enter(shared->m);
+        size_t *block = atomic_load(&shared->current);
+        for (size_t i = 1; i < 8; i++)
+        {
+            assert(block[i] == block[0]);
+        }
+        fancy_memory_read_exit(shared->m);
+    }
+    return NULL;
+}
+
+static void test_retire(fancy_memory_t *m)
+{
+    void *blocks[100];
+    for (size_t i = 0; i < 100; i++)
+    {
+        blocks[i] = fancy_memory_malloc(m, 32);
+    }
+
+    // Nothing retired while the (nested) section is entered is freed, even once more
+    // than a batch is pending.
+    fancy_memory_read_enter(m);
+    fancy_memory_read_enter(m);
+    for (size_t i = 0; i < 100; i++)
+    {
+        fancy_memory_retire(m, blocks[i]);
+    }
+    fancy_memory_read_exit(m);
+    assert(fancy_memory_reclaim(m) == 0);
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_bytes == 0 && stats.live_count == 0);
+    assert(stats.retired_bytes == 100 * 32 && stats.retired_count == 100);
+    assert(fancy_memory_get_total(m) == 0);
+    size_t total = 0;
+    assert(fancy_memory_foreach(m, count_block, &total) == 100);
+    fancy_memory_read_exit(m);
+    assert(fancy_memory_reclaim(m) == 100);
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.retired_bytes == 0 && stats.retired_count == 0 && stats.free_count == 100);
+
+    // Pending blocks are freed by a reset as well.
+    fancy_memory_retire(m, fancy_memory_malloc(m, 16));
+    fancy_memory_reset(m);
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_bytes == 0 && stats.retired_bytes == 0 && stats.retired_count == 0);
+
+    // The writer keeps replacing the current block while the readers check it.
+    retire_shared_t shared = {.m = m};
+    size_t *block = fancy_memory_malloc(m, sizeof(size_t) * 8);
+    for (size_t i = 0; i < 8; i++)
+    {
+        block[i] = 0;
+    }
+    atomic_init(&shared.current, block);
+    atomic_init(&shared.done, false);
+    pthread_t threads[CONCURRENT_NUMBER_OF_THREADS];
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        assert(pthread_create(&threads[i], NULL, retire_reader, &shared) == 0);
+    }
+    for (size_t round = 1; round <= 20000; round++)
+    {
+        block = fancy_memory_malloc(m, sizeof(size_t) * 8);
+        for (size_t i = 0; i < 8; i++)
+        {
+            block[i] = round;
+        }
+        fancy_memory_retire(m, atomic_exchange(&shared.current, block));
+    }
+    atomic_store(&shared.done, true);
+    for (size_t i = 0; i < CONCURRENT_NUMBER_OF_THREADS; i++)
+    {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    fancy_memory_reclaim(m);
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.retired_count == 0 && stats.live_count == 1);
+    fancy_memory_destroy(m);
+}
+
+static void *retire_stats_poller(void *argument)
+{
+    // At most one block (of 64 bytes) is ever live, but the shards are read one after the
+    // other, so each of the 64 shards may still report one. Anything more means that a
+    // retired block was subtracted without having been counted as live (i.e., wrapped).
+    retire_shared_t *shared = argument;
+    while (!atomic_load(&shared->done))
+    {
+        fancy_memory_stats_t stats;
+        fancy_memory_get_stats(shared->m, &stats);
+        assert(stats.live_bytes <= 64 * 64 && stats.live_count <= 64);
+    }
+    return NULL;
+}
+
+static void test_retire_stats(void)
+{
+    retire_shared_t shared = {.m = fancy_memory_create_concurrent(64)};
+    atomic_init(&shared.current, NULL);
+    atomic_init(&shared.done, false);
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, retire_stats_poller, &shared) == 0);
+    for (size_t i = 0; i < 200000; i++)
+    {
+        fancy_memory_retire(shared.m, fancy_memory_malloc(shared.m, 64));
+    }
+    atomic_store(&shared.done, true);
+    assert(pthread_join(thread, NULL) == 0);
+    fancy_memory_reclaim(shared.m);
+    assert(fancy_memory_get_total(shared.m) == 0);
+    fancy_memory_destroy(shared.m);
+}
+
+static void test_retire_misuse(fancy_memory_t *m)
+{
+    // Each misuse of the retired block happens in a child process, which must terminate
+    // with a failure (instead of, e.g., freeing the block twice), while the parent's copy
+    // of the tracker is left untouched for the next one.
+    void *retired = fancy_memory_malloc(m, 64);
+    fancy_memory_read_enter(m);
+    fancy_memory_retire(m, retired);
+    for (int misuse = 0; misuse < 5; misuse++)
+    {
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        assert(pid != -1);
+        if (pid == 0)
+        {
+            // The expected error message is not part of the tests' output.
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDERR_FILENO);
+            if (misuse == 0)
+            {
+                fancy_memory_retire(m, retired);
+            }
+            else if (misuse == 1)
+            {
+                fancy_memory_free(m, retired);
+            }
+            else if (misuse == 2)
+            {
+                fancy_memory_try_free(m, retired);
+            }
+            else if (misuse == 3)
+            {
+                fancy_memory_realloc(m, retired, 128);
+            }
+            else
+            {
+                fancy_memory_free_many(m, &retired, 1);
+            }
+            _exit(0);
+        }
+        int status;
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_FAILURE);
+    }
+
+    // Reclamation still frees the block, whose address can then be handed out again.
+    fancy_memory_read_exit(m);
+    assert(fancy_memory_reclaim(m) == 1);
+    assert(fancy_memory_get_total(m) == 0);
+    void *reused = fancy_memory_malloc(m, 64);
+    fancy_memory_retire(m, reused);
+    assert(fancy_memory_reclaim(m) == 1);
+    fancy_memory_destroy(m);
+}
+
+static int run_tool(char const *tool, char const *argument, char const *output)
+{
+    // Runs one of the tools (which the Makefile builds before running the tests), with
+    // its standard output written to `output`, and returns its exit status.
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0)
+    {
+        int descriptor = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(descriptor, STDOUT_FILENO);
+        execl(tool, tool, argument, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) != 127);
+    return WEXITSTATUS(status);
+}
+
+static void test_retire_exports(fancy_memory_t *m)
+{
+    // The snapshot and the published counters agree with the statistics (and, thus, with
+    // the tools) while a retired block is still pending.
+    char name[64];
+    snprintf(name, sizeof(name), "/fancy_memory_test_%ld", (long)getpid());
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/fancy_memory_test_%ld", (long)getpid());
+    void *kept = fancy_memory_malloc(m, 100);
+    assert(fancy_memory_publish(m, name));
+    fancy_memory_read_enter(m);
+    fancy_memory_retire(m, fancy_memory_malloc(m, 200));
+    assert(fancy_memory_get_total(m) == 100);
+
+    FILE *stream = fopen(path, "wb");
+    assert(stream != NULL);
+    assert(fancy_memory_snapshot_write(m, stream));
+    fclose(stream);
+    assert(run_tool("build/fancy_memory_snapshot", path, "/dev/null") == 0);
+
+    assert(run_tool("build/fancy_memory_monitor", name, path) == 0);
+    stream = fopen(path, "r");
+    assert(stream != NULL);
+    char line[4096] = {0};
+    assert(fgets(line, sizeof(line), stream) != NULL);
+    fclose(stream);
+    char const *field = strstr(line, "\"live_bytes\":");
+    assert(field != NULL && strtoull(field + strlen("\"live_bytes\":"), NULL, 10) == 100);
+    field = strstr(line, "\"live_count\":");
+    assert(field != NULL && strtoull(field + strlen("\"live_count\":"), NULL, 10) == 1);
+
+    fancy_memory_read_exit(m);
+    assert(fancy_memory_reclaim(m) == 1);
+    fancy_memory_free(m, kept);
+    unlink(path);
+    fancy_memory_destroy(m);
+}
+
+static void *concurrent_fill(void *argument)
+{
+    concurrent_worker_t *worker = argument;
+    for (size_t i = 0; i < worker->n; i++)
+    {
+        worker->live[i] = fancy_memory_malloc(worker->m, 16);
+        worker->total += 16;
+    }
+    return NULL;
+}
+
+static void test_snapshot_concurrent(void)
+{
+    // Another thread keeps allocating while the snapshots are written, such that the
+    // shards (written last) hold more blocks than the statistics (read first) counted.
+    fancy_memory_t *m = fancy_memory_create_concurrent(8);
+    concurrent_worker_t worker = {.m = m, .n = CONCURRENT_NUMBER_OF_OPERATIONS};
+    worker.live = malloc(sizeof(char *) * worker.n);
+    assert(worker.live != NULL);
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/fancy_memory_test_%ld", (long)getpid());
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, concurrent_fill, &worker) == 0);
+    for (size_t i = 0; i < 10; i++)
+    {
+        FILE *stream = fopen(path, "wb");
+        assert(stream != NULL);
+        assert(fancy_memory_snapshot_write(m, stream));
+        fclose(stream);
+        assert(run_tool("build/fancy_memory_snapshot", path, "/dev/null") == 0);
+    }
+    assert(pthread_join(thread, NULL) == 0);
+    assert(fancy_memory_get_total(m) == worker.total);
+    concurrent_drain(&worker);
+    free(worker.live);
+    unlink(path);
+    fancy_memory_destroy(m);
+}
+
+typedef struct
+{
+    fancy_memory_t *m;
+    size_t min_total;
+    _Atomic(bool) done;
+} stats_poller_t;
+
+static void *realloc_stats_poller(void *argument)
+{
+    stats_poller_t *poller = argument;
+    while (!atomic_load(&poller->done))
+    {
+        assert(fancy_memory_get_total(poller->m) >= poller->min_total);
+    }
+    return NULL;
+}
+
+static void test_concurrent_peaks_and_reallocs(void)
+{
+    // The peaks are kept by the shards, such that they are not missed when the statistics
+    // are not read at the right time.
+    fancy_memory_t *m = fancy_memory_create_concurrent(4);
+    void *pointers[100];
+    for (size_t i = 0; i < 100; i++)
+    {
+        pointers[i] = fancy_memory_malloc(m, 10);
+    }
+    for (size_t i = 0; i < 100; i++)
+    {
+        fancy_memory_free(m, pointers[i]);
+    }
+    fancy_memory_stats_t stats;
+    fancy_memory_get_stats(m, &stats);
+    assert(stats.live_bytes == 0 && stats.peak_bytes >= 1000 && stats.peak_count >= 100);
+    fancy_memory_destroy(m);
+
+    // A block that is being reallocated stays counted (a single shard is read at once).
+    stats_poller_t poller = {.m = fancy_memory_create_concurrent(1), .min_total = 32 * 1024};
+    atomic_init(&poller.done, false);
+    void *pointer = fancy_memory_malloc(poller.m, poller.min_total);
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, realloc_stats_poller, &poller) == 0);
+    for (size_t i = 0; i < 20000; i++)
+    {
+        pointer = fancy_memory_realloc(poller.m, pointer, poller.min_total * (1 + i % 2));
+    }
+    atomic_store(&poller.done, true);
+    assert(pthread_join(thread, NULL) == 0);
+    fancy_memory_get_stats(poller.m, &stats);
+    assert(stats.peak_bytes == poller.min_total * 2 && stats.peak_count == 1);
+    fancy_memory_free(poller.m, pointer);
+    fancy_memory_destroy(poller.m);
+}
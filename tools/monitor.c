@@ -0,0 +1,249 @@
+/*
+    Copyright (c) 2023 BB-301 <fw3dg3@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the “Software”), to deal in the Software without restriction,
+    including without limitation the rights to use, copy, modify, merge,
+    publish, distribute, sublicense, and/or sell copies of the Software,
+    and to permit persons to whom the Software is furnished to do so,
+    subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    A small command-line tool that samples the counters that a process publishes using
+    `fancy_memory_publish`, without interrupting (or slowing down) that process, and
+    writes each sample as a JSON line to `stdout`.
+
+    Usage: fancy_memory_monitor <name> [<interval in milliseconds> [<sample count>]]
+
+    A single sample is taken by default, while a sample count of 0 samples until the
+    object is removed (e.g., when the tracker is destroyed) or the tool is interrupted.
+    The counters of the slots of concurrent trackers (i.e., one per shard) are summed,
+    such that their peaks are an upper bound of the tracker's actual peaks.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The layout of the shared memory object, as documented in `src/fancy_memory.c`.
+#define MONITOR_MAGIC "FANCYSHM"
+#define MONITOR_VERSION (1)
+#define MONITOR_BUCKETS (65)
+#define MONITOR_CACHE_LINE_SIZE (64)
+#define MONITOR_MAX_ATTEMPTS (100000000UL)
+
+typedef struct
+{
+    _Alignas(MONITOR_CACHE_LINE_SIZE) _Atomic(uint64_t) sequence;
+    _Atomic(uint64_t) live_bytes;
+    _Atomic(uint64_t) live_count;
+    _Atomic(uint64_t) peak_bytes;
+    _Atomic(uint64_t) peak_count;
+    _Atomic(uint64_t) allocation_count;
+    _Atomic(uint64_t) free_count;
+    _Atomic(uint64_t) reallocation_count;
+    _Atomic(uint64_t) live_counts[MONITOR_BUCKETS];
+} monitor_slot_t;
+
+typedef struct
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t pid;
+    uint64_t backend;
+    uint64_t slot_count;
+    uint64_t bucket_count;
+    monitor_slot_t slots[];
+} monitor_page_t;
+
+typedef struct
+{
+    uint64_t live_bytes;
+    uint64_t live_count;
+    uint64_t peak_bytes;
+    uint64_t peak_count;
+    uint64_t allocation_count;
+    uint64_t free_count;
+    uint64_t reallocation_count;
+    uint64_t live_counts[MONITOR_BUCKETS];
+} monitor_sample_t;
+
+static void fail(char const *name, char const *message);
+static monitor_page_t const *monitor_open(char const *name, size_t *size);
+static void monitor_read_slot(monitor_slot_t const *slot, monitor_sample_t *sample);
+static void monitor_print(monitor_page_t const *page, monitor_sample_t const *sample);
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 4)
+    {
+        fprintf(stderr, "Usage: %s <name> [<interval in milliseconds> [<sample count>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long interval = argc > 2 ? strtol(argv[2], NULL, 10) : 1000;
+    unsigned long count = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+    size_t size;
+    monitor_page_t const *page = monitor_open(argv[1], &size);
+    struct timespec pause = {.tv_sec = interval / 1000, .tv_nsec = (interval % 1000) * 1000000};
+    for (unsigned long i = 0; count == 0 || i < count; i++)
+    {
+        if (i > 0)
+        {
+            nanosleep(&pause, NULL);
+            // The object is unlinked once the tracker stops publishing, but the
+            // mapping stays valid, so its name is checked instead.
+            int descriptor = shm_open(argv[1], O_RDONLY, 0);
+            if (descriptor == -1)
+            {
+                break;
+            }
+            close(descriptor);
+        }
+        monitor_sample_t total = {0};
+        for (uint64_t j = 0; j < page->slot_count; j++)
+        {
+            monitor_sample_t sample;
+            monitor_read_slot(&page->slots[j], &sample);
+            total.live_bytes += sample.live_bytes;
+            total.live_count += sample.live_count;
+            total.peak_bytes += sample.peak_bytes;
+            total.peak_count += sample.peak_count;
+            total.allocation_count += sample.allocation_count;
+            total.free_count += sample.free_count;
+            total.reallocation_count += sample.reallocation_count;
+            for (size_t k = 0; k < MONITOR_BUCKETS; k++)
+            {
+                total.live_counts[k] += sample.live_counts[k];
+            }
+        }
+        monitor_print(page, &total);
+    }
+    munmap((void *)page, size);
+    return EXIT_SUCCESS;
+}
+
+static void fail(char const *name, char const *message)
+{
+    fprintf(stderr, "%s: %s\n", name, message);
+    exit(EXIT_FAILURE);
+}
+
+static monitor_page_t const *monitor_open(char const *name, size_t *size)
+{
+    int descriptor = shm_open(name, O_RDONLY, 0);
+    if (descriptor == -1)
+    {
+        fail(name, "unable to open the shared memory object");
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) == -1 || (size_t)status.st_size < sizeof(monitor_page_t))
+    {
+        fail(name, "not a published tracker");
+    }
+    *size = (size_t)status.st_size;
+    monitor_page_t const *page = mmap(NULL, *size, PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (page == MAP_FAILED)
+    {
+        fail(name, "unable to map the shared memory object");
+    }
+    // The magic is written last by the publishing process.
+    if (memcmp(page->magic, MONITOR_MAGIC, sizeof(page->magic)) != 0)
+    {
+        fail(name, "not a published tracker (or not yet fully published)");
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (page->version != MONITOR_VERSION || page->bucket_count != MONITOR_BUCKETS ||
+        sizeof(monitor_page_t) + sizeof(monitor_slot_t) * page->slot_count > *size)
+    {
+        fail(name, "unsupported version");
+    }
+    return page;
+}
+
+static void monitor_read_slot(monitor_slot_t const *slot, monitor_sample_t *sample)
+{
+    // The sample is only accepted if the (even) sequence did not change while it was
+    // being copied, i.e., if no update was in progress. Updates only take a few stores,
+    // so a slot that stays odd means that its writer died in the middle of one.
+    for (unsigned long attempt = 0;; attempt++)
+    {
+        if (attempt == MONITOR_MAX_ATTEMPTS)
+        {
+            fail("monitor", "a slot is stuck in an update");
+        }
+        uint64_t before = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if ((before & 1) != 0)
+        {
+            continue;
+        }
+        sample->live_bytes = atomic_load_explicit(&slot->live_bytes, memory_order_relaxed);
+        sample->live_count = atomic_load_explicit(&slot->live_count, memory_order_relaxed);
+        sample->peak_bytes = atomic_load_explicit(&slot->peak_bytes, memory_order_relaxed);
+        sample->peak_count = atomic_load_explicit(&slot->peak_count, memory_order_relaxed);
+        sample->allocation_count = atomic_load_explicit(&slot->allocation_count, memory_order_relaxed);
+        sample->free_count = atomic_load_explicit(&slot->free_count, memory_order_relaxed);
+        sample->reallocation_count = atomic_load_explicit(&slot->reallocation_count, memory_order_relaxed);
+        for (size_t i = 0; i < MONITOR_BUCKETS; i++)
+        {
+            sample->live_counts[i] = atomic_load_explicit(&slot->live_counts[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) == before)
+        {
+            return;
+        }
+    }
+}
+
+static void monitor_print(monitor_page_t const *page, monitor_sample_t const *sample)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    fprintf(stdout,
+            "{\"time\":%lld.%03ld,\"pid\":%" PRIu64 ",\"shards\":%" PRIu64 ",\"live_bytes\":%" PRIu64
+            ",\"live_count\":%" PRIu64 ",\"peak_bytes\":%" PRIu64 ",\"peak_count\":%" PRIu64
+            ",\"allocation_count\":%" PRIu64 ",\"free_count\":%" PRIu64 ",\"reallocation_count\":%" PRIu64
+            ",\"live_counts\":{",
+            (long long)now.tv_sec, now.tv_nsec / 1000000, page->pid, page->slot_count, sample->live_bytes,
+            sample->live_count, sample->peak_bytes, sample->peak_count, sample->allocation_count,
+            sample->free_count, sample->reallocation_count);
+    // The live counts are keyed by the smallest size of their bucket.
+    bool first = true;
+    for (size_t i = 0; i < MONITOR_BUCKETS; i++)
+    {
+        if (sample->live_counts[i] == 0)
+        {
+            continue;
+        }
+        uint64_t low = i == 0 ? 0 : UINT64_C(1) << (i - 1);
+        fprintf(stdout, "%s\"%" PRIu64 "\":%" PRIu64, first ? "" : ",", low, sample->live_counts[i]);
+        first = false;
+    }
+    fprintf(stdout, "}}\n");
+    fflush(stdout);
+}
@@ -0,0 +1,444 @@
+/*
+    Copyright (c) 2023 BB-301 <fw3dg3@gmail.com>
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the “Software”), to deal in the Software without restriction,
+    including without limitation the rights to use, copy, modify, merge,
+    publish, distribute, sublicense, and/or sell copies of the Software,
+    and to permit persons to whom the Software is furnished to do so,
+    subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    A small command-line tool that reads snapshots written by `fancy_memory_snapshot_write`
+    and reports their totals and top sizes, as well as (when given two snapshots) the
+    growth between them, by size and by allocation site.
+
+    Usage: fancy_memory_snapshot <snapshot> [<later snapshot>]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define SNAPSHOT_MAGIC "FANCYMEM"
+#define SNAPSHOT_VERSION (1)
+#define SNAPSHOT_BUCKETS (65)
+#define SNAPSHOT_TOP_COUNT (10)
+
+typedef struct
+{
+    unsigned char const *data;
+    size_t length;
+    size_t position;
+    char const *path;
+} snapshot_reader_t;
+
+typedef struct
+{
+    char *file;
+    int64_t line;
+    char *function;
+    uint64_t live_bytes;
+    uint64_t live_count;
+    uint64_t allocation_count;
+    uint64_t allocated_bytes;
+} snapshot_site_t;
+
+typedef struct
+{
+    // The number of tracked blocks (and the number of bytes they hold) of a given size.
+    uint64_t size;
+    int64_t count;
+    int64_t bytes;
+} snapshot_size_t;
+
+typedef struct
+{
+    uint64_t backend;
+    uint64_t shard_count;
+    uint64_t live_bytes;
+    uint64_t live_count;
+    uint64_t peak_bytes;
+    uint64_t peak_count;
+    uint64_t allocation_count;
+    uint64_t free_count;
+    uint64_t reallocation_count;
+    uint64_t sizes[SNAPSHOT_BUCKETS];
+    uint64_t lifetimes[SNAPSHOT_BUCKETS];
+    snapshot_site_t *sites;
+    size_t site_count;
+    // The tracked blocks, aggregated by size (sorted by increasing size).
+    snapshot_size_t *by_size;
+    size_t size_count;
+} snapshot_t;
+
+static void fail(char const *path, char const *message);
+static uint64_t read_u64(snapshot_reader_t *reader);
+static char *read_string(snapshot_reader_t *reader);
+static void snapshot_load(snapshot_t *snapshot, char const *path);
+static void snapshot_free(snapshot_t *snapshot);
+static int compare_u64(void const *a, void const *b);
+static int compare_size_bytes(void const *a, void const *b);
+static int compare_site_bytes(void const *a, void const *b);
+static void print_totals(snapshot_t const *snapshot, char const *path);
+static void print_sizes(snapshot_size_t const *sizes, size_t count, char const *title, bool growth);
+static void print_growth(snapshot_t const *before, snapshot_t const *after);
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <snapshot> [<later snapshot>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    snapshot_t before;
+    snapshot_load(&before, argv[1]);
+    print_totals(&before, argv[1]);
+    if (argc == 3)
+    {
+        snapshot_t after;
+        snapshot_load(&after, argv[2]);
+        print_totals(&after, argv[2]);
+        print_growth(&before, &after);
+        snapshot_free(&after);
+    }
+    snapshot_free(&before);
+    return EXIT_SUCCESS;
+}
+
+static void fail(char const *path, char const *message)
+{
+    fprintf(stderr, "%s: %s\n", path, message);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t read_u64(snapshot_reader_t *reader)
+{
+    if (reader->length - reader->position < 8)
+    {
+        fail(reader->path, "unexpected end of file");
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; i++)
+    {
+        value |= (uint64_t)reader->data[reader->position + i] << (8 * i);
+    }
+    reader->position += 8;
+    return value;
+}
+
+static char *read_string(snapshot_reader_t *reader)
+{
+    uint64_t length = read_u64(reader);
+    if (reader->length - reader->position < length)
+    {
+        fail(reader->path, "unexpected end of file");
+    }
+    char *string = malloc((size_t)length + 1);
+    if (string == NULL)
+    {
+        fail(reader->path, "out of memory");
+    }
+    memcpy(string, reader->data + reader->position, (size_t)length);
+    string[length] = '\0';
+    reader->position += (size_t)length;
+    return string;
+}
+
+static void snapshot_load(snapshot_t *snapshot, char const *path)
+{
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL)
+    {
+        fail(path, "cannot open file");
+    }
+    size_t capacity = 1024 * 1024;
+    size_t length = 0;
+    unsigned char *data = malloc(capacity);
+    while (data != NULL)
+    {
+        length += fread(data + length, 1, capacity - length, stream);
+        if (length < capacity)
+        {
+            break;
+        }
+        capacity *= 2;
+        unsigned char *grown = realloc(data, capacity);
+        if (grown == NULL)
+        {
+            free(data);
+        }
+        data = grown;
+    }
+    if (data == NULL)
+    {
+        fail(path, "out of memory");
+    }
+    if (ferror(stream))
+    {
+        fail(path, "cannot read file");
+    }
+    fclose(stream);
+
+    snapshot_reader_t reader = {data, length, 0, path};
+    if (length < 8 || memcmp(data, SNAPSHOT_MAGIC, 8) != 0)
+    {
+        fail(path, "not a fancy_memory snapshot");
+    }
+    reader.position = 8;
+    if (read_u64(&reader) != SNAPSHOT_VERSION)
+    {
+        fail(path, "unsupported snapshot version");
+    }
+    *snapshot = (snapshot_t){0};
+    snapshot->backend = read_u64(&reader);
+    snapshot->shard_count = read_u64(&reader);
+    snapshot->live_bytes = read_u64(&reader);
+    snapshot->live_count = read_u64(&reader);
+    snapshot->peak_bytes = read_u64(&reader);
+    snapshot->peak_count = read_u64(&reader);
+    snapshot->allocation_count = read_u64(&reader);
+    snapshot->free_count = read_u64(&reader);
+    snapshot->reallocation_count = read_u64(&reader);
+    if (read_u64(&reader) != SNAPSHOT_BUCKETS)
+    {
+        fail(path, "unexpected number of histogram buckets");
+    }
+    for (size_t i = 0; i < SNAPSHOT_BUCKETS; i++)
+    {
+        snapshot->sizes[i] = read_u64(&reader);
+    }
+    for (size_t i = 0; i < SNAPSHOT_BUCKETS; i++)
+    {
+        snapshot->lifetimes[i] = read_u64(&reader);
+    }
+
+    uint64_t site_count = read_u64(&reader);
+    if (site_count > length)
+    {
+        fail(path, "invalid site count");
+    }
+    snapshot->site_count = (size_t)site_count;
+    snapshot->sites = calloc(snapshot->site_count + 1, sizeof(snapshot_site_t));
+    if (snapshot->sites == NULL)
+    {
+        fail(path, "out of memory");
+    }
+    for (size_t i = 0; i < snapshot->site_count; i++)
+    {
+        snapshot_site_t *site = &snapshot->sites[i];
+        site->file = read_string(&reader);
+        site->line = (int64_t)read_u64(&reader);
+        site->function = read_string(&reader);
+        site->live_bytes = read_u64(&reader);
+        site->live_count = read_u64(&reader);
+        site->allocation_count = read_u64(&reader);
+        site->allocated_bytes = read_u64(&reader);
+    }
+
+    // Only the sizes of the entries are needed, which are sorted and then aggregated.
+    // The live count is not an upper bound of the number of entries (e.g., the shards of
+    // a concurrent tracker are written after its statistics were read, while its other
+    // threads keep running), but the rest of the file is, since each entry takes 16 bytes.
+    uint64_t *sizes = malloc(sizeof(uint64_t) * ((length - reader.position) / 16 + 1));
+    if (sizes == NULL)
+    {
+        fail(path, "out of memory");
+    }
+    size_t n = 0;
+    for (uint64_t count = read_u64(&reader); count > 0; count = read_u64(&reader))
+    {
+        if (count > (length - reader.position) / 16)
+        {
+            fail(path, "invalid entry count");
+        }
+        for (uint64_t i = 0; i < count; i++)
+        {
+            read_u64(&reader);
+            sizes[n++] = read_u64(&reader);
+        }
+    }
+    qsort(sizes, n, sizeof(uint64_t), compare_u64);
+    snapshot->by_size = malloc(sizeof(snapshot_size_t) * (n + 1));
+    if (snapshot->by_size == NULL)
+    {
+        fail(path, "out of memory");
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        if (snapshot->size_count == 0 || snapshot->by_size[snapshot->size_count - 1].size != sizes[i])
+        {
+            snapshot->by_size[snapshot->size_count++] = (snapshot_size_t){sizes[i], 0, 0};
+        }
+        snapshot->by_size[snapshot->size_count - 1].count += 1;
+        snapshot->by_size[snapshot->size_count - 1].bytes += (int64_t)sizes[i];
+    }
+    free(sizes);
+    free(data);
+}
+
+static void snapshot_free(snapshot_t *snapshot)
+{
+    for (size_t i = 0; i < snapshot->site_count; i++)
+    {
+        free(snapshot->sites[i].file);
+        free(snapshot->sites[i].function);
+    }
+    free(snapshot->sites);
+    free(snapshot->by_size);
+}
+
+static int compare_u64(void const *a, void const *b)
+{
+    uint64_t x = *(uint64_t const *)a;
+    uint64_t y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_size_bytes(void const *a, void const *b)
+{
+    snapshot_size_t const *x = a;
+    snapshot_size_t const *y = b;
+    if (x->bytes != y->bytes)
+    {
+        return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+    }
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+static int compare_site_bytes(void const *a, void const *b)
+{
+    // Sites are compared on their (signed) live bytes growth, stored in `live_bytes`.
+    int64_t x = (int64_t)((snapshot_site_t const *)a)->live_bytes;
+    int64_t y = (int64_t)((snapshot_site_t const *)b)->live_bytes;
+    return (x < y) - (x > y);
+}
+
+static void print_totals(snapshot_t const *snapshot, char const *path)
+{
+    printf("%s:\n", path);
+    printf("\tlive = %" PRIu64 " bytes in %" PRIu64 " blocks (peak = %" PRIu64 " bytes in %" PRIu64 " blocks)\n",
+           snapshot->live_bytes, snapshot->live_count, snapshot->peak_bytes, snapshot->peak_count);
+    printf("\tallocations = %" PRIu64 ", frees = %" PRIu64 ", reallocations = %" PRIu64 "\n",
+           snapshot->allocation_count, snapshot->free_count, snapshot->reallocation_count);
+    snapshot_size_t *sizes = malloc(sizeof(snapshot_size_t) * (snapshot->size_count + 1));
+    if (sizes == NULL)
+    {
+        fail(path, "out of memory");
+    }
+    memcpy(sizes, snapshot->by_size, sizeof(snapshot_size_t) * snapshot->size_count);
+    qsort(sizes, snapshot->size_count, sizeof(snapshot_size_t), compare_size_bytes);
+    print_sizes(sizes, snapshot->size_count, "top sizes (by live bytes)", false);
+    free(sizes);
+    printf("\n");
+}
+
+static void print_sizes(snapshot_size_t const *sizes, size_t count, char const *title, bool growth)
+{
+    printf("\t%s {\n", title);
+    for (size_t i = 0; i < count && i < SNAPSHOT_TOP_COUNT; i++)
+    {
+        if (growth)
+        {
+            printf("\t\t.[size = %" PRIu64 "] = { blocks = %+" PRId64 ", bytes = %+" PRId64 " },\n",
+                   sizes[i].size, sizes[i].count, sizes[i].bytes);
+        }
+        else
+        {
+            printf("\t\t.[size = %" PRIu64 "] = { blocks = %" PRId64 ", bytes = %" PRId64 " },\n",
+                   sizes[i].size, sizes[i].count, sizes[i].bytes);
+        }
+    }
+    printf("\t}\n");
+}
+
+static void print_growth(snapshot_t const *before, snapshot_t const *after)
+{
+    printf("growth:\n");
+    printf("\tlive = %+" PRId64 " bytes in %+" PRId64 " blocks\n",
+           (int64_t)(after->live_bytes - before->live_bytes), (int64_t)(after->live_count - before->live_count));
+
+    // Both snapshots are sorted by size, so they are merged in a single pass.
+    snapshot_size_t *sizes = malloc(sizeof(snapshot_size_t) * (before->size_count + after->size_count + 1));
+    if (sizes == NULL)
+    {
+        fail("growth", "out of memory");
+    }
+    size_t n = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < before->size_count || j < after->size_count)
+    {
+        snapshot_size_t size;
+        if (j == after->size_count || (i < before->size_count && before->by_size[i].size < after->by_size[j].size))
+        {
+            size = before->by_size[i++];
+            size.count = -size.count;
+            size.bytes = -size.bytes;
+        }
+        else if (i == before->size_count || after->by_size[j].size < before->by_size[i].size)
+        {
+            size = after->by_size[j++];
+        }
+        else
+        {
+            size = after->by_size[j++];
+            size.count -= before->by_size[i].count;
+            size.bytes -= before->by_size[i++].bytes;
+        }
+        if (size.count != 0)
+        {
+            sizes[n++] = size;
+        }
+    }
+    qsort(sizes, n, sizeof(snapshot_size_t), compare_size_bytes);
+    print_sizes(sizes, n, "top growing sizes (by live bytes)", true);
+    free(sizes);
+
+    // Sites are few, so they are simply matched in quadratic time.
+    snapshot_site_t *sites = malloc(sizeof(snapshot_site_t) * (after->site_count + 1));
+    if (sites == NULL)
+    {
+        fail("growth", "out of memory");
+    }
+    for (size_t k = 0; k < after->site_count; k++)
+    {
+        sites[k] = after->sites[k];
+        for (size_t l = 0; l < before->site_count; l++)
+        {
+            snapshot_site_t const *site = &before->sites[l];
+            if (site->line == sites[k].line && strcmp(site->file, sites[k].file) == 0 &&
+                strcmp(site->function, sites[k].function) == 0)
+            {
+                sites[k].live_bytes -= site->live_bytes;
+                sites[k].live_count -= site->live_count;
+                break;
+            }
+        }
+    }
+    qsort(sites, after->site_count, sizeof(snapshot_site_t), compare_site_bytes);
+    printf("\ttop growing sites (by live bytes) {\n");
+    for (size_t k = 0; k < after->site_count && k < SNAPSHOT_TOP_COUNT; k++)
+    {
+        printf("\t\t.[%s:%" PRId64 " (%s)] = { blocks = %+" PRId64 ", bytes = %+" PRId64 " },\n", sites[k].file,
+               sites[k].line, sites[k].function, (int64_t)sites[k].live_count, (int64_t)sites[k].live_bytes);
+    }
+    printf("\t}\n");
+    free(sites);
+}